@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Host benchmark for scron_schedule_next_time. Before timing anything, this
+// checks that the arithmetic implementation matches the original gmtime based
+// one for every second of a full day, and fails if they ever disagree.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <scron.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+// The original gmtime based implementation, kept as a reference
+static time_t reference_next_time(const struct scron_schedule *sched, time_t now)
+{
+	time_t next = now;
+	if (sched->second < 0 && sched->minute < 0 && sched->hour < 0)
+	{
+		next += 5;
+		return next;
+	}
+
+	struct tm now_tm = *gmtime(&now);
+	if (sched->hour >= 0)
+	{
+		int diff = (sched->hour - now_tm.tm_hour) * 3600;
+		if (diff < 0)
+		{
+			diff += 3600 * 24;
+		}
+		next += diff;
+	}
+	if (sched->minute >= 0)
+	{
+		int diff = (sched->minute - now_tm.tm_min) * 60;
+		if (diff < 0)
+		{
+			diff += 3600;
+		}
+		next += diff;
+	}
+	if (sched->second >= 0)
+	{
+		int diff = (sched->second - now_tm.tm_sec);
+		if (diff < 0)
+		{
+			diff += 60;
+		}
+		next += diff;
+	}
+
+	if (now == next)
+	{
+		if (sched->second < 0)
+			next += 5;
+		else if (sched->minute < 0)
+			next += 60;
+		else if (sched->hour < 0)
+			next += 3600;
+	}
+	return next;
+}
+
+// Midnight, 2023-01-01 UTC
+static const time_t day_start = 1672531200;
+
+// Builds a set of schedules covering every single field value, plus a
+// pseudo-random sample of schedules mixing fields
+static size_t make_schedules(struct scron_schedule *scheds, size_t size)
+{
+	size_t count = 0;
+	scheds[count++] = (struct scron_schedule){ .hour = -1, .minute = -1, .second = -1 };
+	for (int i = 0; i < 24; ++i)
+		scheds[count++] = (struct scron_schedule){ .hour = i, .minute = -1, .second = -1 };
+	for (int i = 0; i < 60; ++i)
+		scheds[count++] = (struct scron_schedule){ .hour = -1, .minute = i, .second = -1 };
+	for (int i = 0; i < 60; ++i)
+		scheds[count++] = (struct scron_schedule){ .hour = -1, .minute = -1, .second = i };
+
+	srand(1);
+	while (count < size)
+	{
+		scheds[count++] = (struct scron_schedule){
+			.hour = rand() % 25 - 1,
+			.minute = rand() % 61 - 1,
+			.second = rand() % 61 - 1,
+		};
+	}
+	return count;
+}
+
+static bool check_equivalence(const struct scron_schedule *scheds, size_t count)
+{
+	for (time_t now = day_start; now < day_start + 86400; ++now)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			time_t expected = reference_next_time(&scheds[i], now);
+			time_t actual = scron_schedule_next_time(&scheds[i], now);
+			if (expected != actual)
+			{
+				fprintf(stderr, "mismatch: %d:%d:%d at %lld: expected %lld, got %lld\n",
+					scheds[i].hour, scheds[i].minute, scheds[i].second,
+					(long long)now, (long long)expected, (long long)actual);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(void)
+{
+	enum { SCHEDULES = 400, ITERATIONS = 2000 };
+	static struct scron_schedule scheds[SCHEDULES];
+	static struct scron_task tasks[SCHEDULES];
+	static struct scron_task_history history[SCHEDULES];
+	static time_t next[SCHEDULES];
+
+	size_t count = make_schedules(scheds, SCHEDULES);
+	if (!check_equivalence(scheds, count))
+		return EXIT_FAILURE;
+	printf("equivalence: %zu schedules x 86400 seconds ok\n", count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		tasks[i].schedule = scheds[i];
+		history[i].last_run = day_start + (time_t)i * 217;
+	}
+
+	struct timespec start, end;
+	volatile time_t sink = 0;
+	const double ops = (double)count * ITERATIONS;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int j = 0; j < ITERATIONS; ++j)
+		for (size_t i = 0; i < count; ++i)
+			sink += reference_next_time(&scheds[i], history[i].last_run + j);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("gmtime reference: %.2f ns/op\n", elapsed_ns(&start, &end) / ops);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int j = 0; j < ITERATIONS; ++j)
+		for (size_t i = 0; i < count; ++i)
+			sink += scron_schedule_next_time(&tasks[i].schedule, history[i].last_run + j);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("scron_schedule_next_time: %.2f ns/op\n", elapsed_ns(&start, &end) / ops);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int j = 0; j < ITERATIONS; ++j)
+	{
+		history[j % count].last_run += 1;
+		scron_schedule_next_times(tasks, count, history, next);
+		sink += next[j % count];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("scron_schedule_next_times: %.2f ns/op\n", elapsed_ns(&start, &end) / ops);
+
+	// Every 15 seconds during the day on weekdays, which has to skip nights
+	// and weekends
+	struct scron_cron cron;
+	if (!scron_cron_parse(&cron, "0/15 * 6-17 * * 1-5"))
+		return EXIT_FAILURE;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int j = 0; j < ITERATIONS; ++j)
+		for (size_t i = 0; i < count; ++i)
+			sink += scron_cron_next_time(&cron, history[i].last_run + j * 97);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("scron_cron_next_time: %.2f ns/op\n", elapsed_ns(&start, &end) / ops);
+
+	(void)sink;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,346 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Host benchmark suite for the scheduler hot paths, from 5 to 10,000 tasks.
+//
+// Every operation runs in a loop that doubles until it takes long enough to
+// time reliably, and is reported in nanoseconds and heap allocations per
+// call. Allocations are counted by wrapping malloc, calloc and realloc at
+// link time (-Wl,--wrap), so the library has to be linked in statically.
+//
+// scron_scan_aos_reference classifies tasks the way scron_scan does, but
+// reading the task and history structs, so the gain of keeping the hot fields
+// in parallel arrays can be measured on any revision.
+//
+// Results are printed as a table, and if a path is given, also written to it
+// as CSV (benchmark,tasks,ns_per_op,allocs_per_op) for comparing revisions.
+//
+// Usage: bench_scheduler [results.csv]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <scron.h>
+#include <artemia.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
+
+// Shortest time a measurement may take, in nanoseconds
+#define BENCH_MIN_TIME 50000000
+
+static size_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	++allocations;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	++allocations;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+	++allocations;
+	return __real_realloc(pointer, size);
+}
+
+struct bench
+{
+	struct scron scron;
+	struct scron_task *tasks;
+	size_t count;
+	// Advanced by every operation, so they don't all hit the same task
+	size_t iteration;
+	time_t now;
+	// Task states for op_scan_reference
+	uint8_t *state;
+};
+
+static int bench_task(void *data)
+{
+	(void)data;
+	return 0;
+}
+
+static void bench_name(char name[32], size_t index)
+{
+	snprintf(name, 32, "task%05zu", index);
+}
+
+// A mix of all three kinds of schedules, all firing at least once a minute so
+// there's always something due
+static void bench_schedule(struct scron_schedule *schedule, size_t index)
+{
+	memset(schedule, 0, sizeof(*schedule));
+	schedule->hour = -1;
+	schedule->minute = -1;
+	schedule->second = -1;
+	switch (index % 3)
+	{
+	case 0:
+		schedule->period = 1 + index % 60;
+		schedule->phase = index % schedule->period;
+		break;
+	case 1:
+		schedule->cron.seconds = SCRON_CRON_BIT(index % 60) | SCRON_CRON_BIT((index + 30) % 60);
+		schedule->cron.minutes = SCRON_CRON_ALL_MINUTES;
+		schedule->cron.hours = SCRON_CRON_ALL_HOURS;
+		schedule->cron.days = SCRON_CRON_ALL_DAYS;
+		schedule->cron.months = SCRON_CRON_ALL_MONTHS;
+		schedule->cron.weekdays = SCRON_CRON_ALL_WEEKDAYS;
+		break;
+	default:
+		schedule->second = index % 60;
+		break;
+	}
+}
+
+static void bench_init(struct bench *bench, size_t count)
+{
+	bench->tasks = calloc(count, sizeof(*bench->tasks));
+	bench->state = calloc(count, sizeof(*bench->state));
+	for (size_t i = 0; i < count; ++i)
+	{
+		bench_name(bench->tasks[i].name, i);
+		bench->tasks[i].function = bench_task;
+		bench->tasks[i].minimum_millivolts = 1800 + (i % 4) * 100;
+		bench->tasks[i].delta = i % 2 ? 30 : 0;
+		bench_schedule(&bench->tasks[i].schedule, i);
+	}
+	const struct scron_tasks table = { count, bench->tasks };
+	if (!scron_init(&bench->scron, &table))
+	{
+		fprintf(stderr, "scron_init: out of memory\n");
+		exit(1);
+	}
+	bench->count = count;
+	bench->iteration = 0;
+	// 2023-01-01T00:00:00Z
+	bench->now = 1672531200;
+	for (size_t i = 0; i < count; ++i)
+		scron_set_last_run(&bench->scron, i, bench->now - (time_t)(count - i));
+}
+
+static void bench_fini(struct bench *bench)
+{
+	scron_delete(&bench->scron);
+	free(bench->tasks);
+	free(bench->state);
+}
+
+static volatile time_t sink;
+
+static void op_schedule_next_time(struct bench *bench)
+{
+	size_t index = bench->iteration++ % bench->count;
+	sink = scron_schedule_next_time(&bench->tasks[index].schedule, bench->now + (time_t)index);
+}
+
+static void op_next_time(struct bench *bench)
+{
+	sink = scron_next_time(&bench->scron);
+}
+
+static void op_artemia_scheduler(struct bench *bench)
+{
+	// Every task fires at least once a minute, so moving a second forward
+	// every call keeps tasks due
+	bench->now += 1;
+	sink = artemia_scheduler(&bench->scron, 3.3, bench->now);
+}
+
+static void op_artemia_scheduler_batch(struct bench *bench)
+{
+	// A full EDF batch considers every due task, and some are below their
+	// minimum voltage or past their delta, so this scans every task
+	static const struct artemia_config config = {
+		.policy = ARTEMIA_POLICY_EDF,
+	};
+	bench->now += 1;
+	sink = artemia_scheduler_batch_millivolts(&bench->scron, &config, 1950, bench->now, NULL);
+}
+
+// Classifies every task over the parallel hot arrays, as the batch scheduler
+// does before walking the run order
+static void op_scan(struct bench *bench)
+{
+	bench->now += 1;
+	sink = scron_scan(&bench->scron, bench->now, 1950);
+}
+
+// The same classification over the task and history structs, the way the
+// scheduler did before the hot fields were kept in parallel arrays, for
+// comparing against scron_scan
+static void op_scan_reference(struct bench *bench)
+{
+	bench->now += 1;
+	const time_t now = bench->now;
+	const uint32_t voltage = 1950;
+	size_t ready = 0;
+	for (size_t i = 0; i < bench->count; ++i)
+	{
+		const struct scron_task *task = scron_get_task(&bench->scron, i);
+		time_t late = now - bench->scron.history[i].next_run;
+		enum scron_scan_state state = SCRON_SCAN_WAITING;
+		if (late >= 0 && task->delta > 0 && late >= task->delta)
+			state = SCRON_SCAN_MISSED;
+		else if (late >= 0)
+			state = task->minimum_millivolts > voltage ?
+				SCRON_SCAN_LOW_VOLTAGE : SCRON_SCAN_DUE;
+		bench->state[i] = state;
+		ready += state != SCRON_SCAN_WAITING;
+	}
+	sink = ready;
+}
+
+static void op_get_task_by_name(struct bench *bench)
+{
+	char name[32];
+	bench_name(name, bench->iteration++ % bench->count);
+	sink = scron_get_task_by_name(&bench->scron, name)->schedule.second;
+}
+
+static void save_callback(const char *name, time_t last_run)
+{
+	(void)name;
+	sink = last_run;
+}
+
+static void load_callback(const char *name, time_t *last_run)
+{
+	(void)name;
+	*last_run = sink;
+}
+
+static void op_save(struct bench *bench)
+{
+	scron_save(&bench->scron, save_callback);
+}
+
+static void op_load(struct bench *bench)
+{
+	scron_load(&bench->scron, load_callback);
+}
+
+static void op_serialize(struct bench *bench)
+{
+	size_t size = scron_serialized_size(&bench->scron);
+	void *buffer = malloc(size);
+	sink = scron_serialize(&bench->scron, buffer, size);
+	free(buffer);
+}
+
+static void op_deserialize(struct bench *bench)
+{
+	size_t size = scron_serialized_size(&bench->scron);
+	void *buffer = malloc(size);
+	scron_serialize(&bench->scron, buffer, size);
+	sink = scron_deserialize(&bench->scron, buffer, size);
+	free(buffer);
+}
+
+struct bench_op
+{
+	const char *name;
+	void (*run)(struct bench *bench);
+};
+
+static const struct bench_op ops[] = {
+	{ "scron_schedule_next_time", op_schedule_next_time },
+	{ "scron_next_time", op_next_time },
+	{ "artemia_scheduler", op_artemia_scheduler },
+	{ "artemia_scheduler_batch", op_artemia_scheduler_batch },
+	{ "scron_scan", op_scan },
+	{ "scron_scan_aos_reference", op_scan_reference },
+	{ "scron_get_task_by_name", op_get_task_by_name },
+	{ "scron_save", op_save },
+	{ "scron_load", op_load },
+	{ "scron_serialize", op_serialize },
+	{ "serialize+deserialize", op_deserialize },
+};
+
+static const size_t sizes[] = { 5, 50, 500, 1000, 5000, 10000 };
+
+static int64_t elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (int64_t)(end->tv_sec - start->tv_sec) * 1000000000 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void measure(const struct bench_op *op, size_t count,
+	double *ns_per_op, double *allocs_per_op)
+{
+	struct bench bench;
+	bench_init(&bench, count);
+	// Fills caches, and whatever lazy allocation there is
+	op->run(&bench);
+
+	for (size_t iterations = 1;; iterations *= 2)
+	{
+		struct timespec start, end;
+		size_t start_allocations = allocations;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < iterations; ++i)
+			op->run(&bench);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		int64_t elapsed = elapsed_ns(&start, &end);
+		if (elapsed >= BENCH_MIN_TIME)
+		{
+			*ns_per_op = (double)elapsed / iterations;
+			*allocs_per_op = (double)(allocations - start_allocations) / iterations;
+			break;
+		}
+	}
+	bench_fini(&bench);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *csv = NULL;
+	if (argc > 1)
+	{
+		csv = fopen(argv[1], "w");
+		if (!csv)
+		{
+			fprintf(stderr, "unable to open %s\n", argv[1]);
+			return 1;
+		}
+		fprintf(csv, "benchmark,tasks,ns_per_op,allocs_per_op\n");
+	}
+
+	FILE *out = stdout;
+
+	fprintf(out, "%-26s %6s %14s %10s\n", "benchmark", "tasks", "ns/op", "allocs/op");
+	for (size_t i = 0; i < ARRAY_SIZE(ops); ++i)
+	{
+		for (size_t j = 0; j < ARRAY_SIZE(sizes); ++j)
+		{
+			double ns_per_op, allocs_per_op;
+			measure(&ops[i], sizes[j], &ns_per_op, &allocs_per_op);
+			fprintf(out, "%-26s %6zu %14.1f %10.2f\n", ops[i].name, sizes[j],
+				ns_per_op, allocs_per_op);
+			fflush(out);
+			if (csv)
+				fprintf(csv, "%s,%zu,%.1f,%.2f\n", ops[i].name, sizes[j],
+					ns_per_op, allocs_per_op);
+		}
+	}
+
+	if (csv && fclose(csv))
+		return 1;
+	return 0;
+}
@@ -1,11 +1,144 @@
 // SPDX-License-Identifier: Apache-2.0
 // SPDX-FileCopyrightText: Gabriel Marcano, 2023
 
+#ifndef ARTEMIA_H_
+#define ARTEMIA_H_
+
 #include <scron.h>
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
+/** Maximum number of tasks the batch scheduler considers in one call. Any
+ *  other eligible tasks are left for the next call.
+ */
+#define ARTEMIA_MAX_BATCH 32
+
+/** Number of buckets the available energy is split into when selecting
+ *  tasks. Task costs are rounded up to a whole bucket.
+ */
+#define ARTEMIA_ENERGY_BUCKETS 63
+
+/** Storage capacitor model.
+ *  - capacitance: capacitance of the storage capacitor, in microfarads. 0
+ *    disables the energy model.
+ *  - floor_voltage: voltage the storage must not drop below, e.g. the
+ *    brown-out voltage of the system, in millivolts.
+ *
+ * The energy stored above the floor is C * (V^2 - floor^2) / 2. It is worked
+ * out in microjoules with integer math only.
+ */
+struct artemia_capacitor
+{
+	uint32_t capacitance;
+	uint32_t floor_voltage;
+};
+
+/** Order in which the batch scheduler considers eligible tasks.
+ *  - ARTEMIA_POLICY_LRU: least recently run first.
+ *  - ARTEMIA_POLICY_EDF: earliest deadline first, the deadline being the end
+ *    of the task's delta window (its next run time plus delta). Tasks without
+ *    a delta have no deadline and go last.
+ */
+enum artemia_policy
+{
+	ARTEMIA_POLICY_LRU,
+	ARTEMIA_POLICY_EDF,
+};
+
+/** Artemia scheduler statistics for one call.
+ *  - ran: number of tasks that ran.
+ *  - missed: number of tasks whose delta window passed before they could run.
+ *    Their missed run is skipped, and they are rescheduled.
+ */
+struct artemia_stats
+{
+	size_t ran;
+	size_t missed;
+};
+
+/** Callback used by the batch scheduler to read the current storage voltage
+ *  between tasks.
+ *
+ * @param[in] data User data from the artemia configuration.
+ *
+ * @returns The current storage voltage level.
+ */
+typedef double (*artemia_voltage_callback)(void *data);
+
+/** Callback used by the batch scheduler to read the current storage voltage
+ *  between tasks, without floating point math, e.g. straight from ADC counts.
+ *
+ * @param[in] data User data from the artemia configuration.
+ *
+ * @returns The current storage voltage level, in millivolts.
+ */
+typedef uint32_t (*artemia_millivolts_callback)(void *data);
+
+/** Callback used by the batch scheduler to get everything a task needs ready
+ *  right before it runs, e.g. to mount the filesystem for tasks with the
+ *  SCRON_TASK_NEEDS_FS flag.
+ *
+ * @param[in] data User data from the artemia configuration.
+ * @param[in] task Task about to run.
+ *
+ * @returns True if the task can run, false if it should be skipped.
+ */
+typedef bool (*artemia_prepare_callback)(void *data, const struct scron_task *task);
+
+/** Callback reading a free running clock, used by the batch scheduler to time
+ *  how long tasks run, and by traces to stamp events.
+ *
+ * @param[in] data User data from the artemia configuration, or the trace.
+ *
+ * @returns The clock reading, in milliseconds for the scheduler. It may wrap
+ *  around.
+ */
+typedef uint32_t (*artemia_clock_callback)(void *data);
+
+struct artemia_trace;
+
+/** Artemia batch scheduler configuration.
+ *  - read_voltage: callback to re-read the storage voltage between tasks. If
+ *    NULL, the voltage given to the scheduler is assumed to hold for the
+ *    whole batch.
+ *  - voltage_data: user data passed to read_voltage and read_millivolts.
+ *  - read_millivolts: callback to re-read the storage voltage in millivolts,
+ *    used instead of read_voltage if set, so the scheduler never touches the
+ *    FPU.
+ *  - max_tasks: maximum number of tasks to run in one batch, 0 meaning
+ *    ARTEMIA_MAX_BATCH.
+ *  - capacitor: storage capacitor model. If set, the energy each task uses is
+ *    learned from the voltage before and after it runs (this needs
+ *    read_millivolts, or read_voltage as a fallback), and the batch is
+ *    chosen to fit the available energy.
+ *  - policy: order in which eligible tasks are considered and run.
+ *  - prepare_task: callback called before every task runs. If NULL, tasks are
+ *    assumed to have everything they need.
+ *  - prepare_data: user data passed to prepare_task.
+ *  - read_clock: callback to time tasks, for their run statistics in scron.
+ *    If NULL, durations are recorded as 0.
+ *  - clock_data: user data passed to read_clock.
+ *  - trace: trace to record scheduler decisions and task runs to, see
+ *    artemia_trace.h. If NULL, nothing is traced.
+ */
+struct artemia_config
+{
+	artemia_voltage_callback read_voltage;
+	void *voltage_data;
+	artemia_millivolts_callback read_millivolts;
+	size_t max_tasks;
+	struct artemia_capacitor capacitor;
+	enum artemia_policy policy;
+	artemia_prepare_callback prepare_task;
+	void *prepare_data;
+	artemia_clock_callback read_clock;
+	void *clock_data;
+	struct artemia_trace *trace;
+};
+
 /** Artemia task scheduler, runs tasks based on the current voltage, time, and
  * the schedules of the tasks.
  *
@@ -25,3 +158,78 @@
  * being.
  */
 bool artemia_scheduler(struct scron *scron, double voltage, time_t now);
+
+/** Artemia task scheduler, as artemia_scheduler, with the voltage in
+ *  millivolts.
+ *
+ * The scheduling decisions use integer math only, so this never touches the
+ * FPU, only the tasks it runs might.
+ *
+ * @param[in,out] scron scron that manages the tasks to be run.
+ * @param[in] voltage Current storage voltage level, in millivolts.
+ * @param[in] now The current time.
+ *
+ * @returns True if a task was run, false otherwise.
+ */
+bool artemia_scheduler_millivolts(struct scron *scron, uint32_t voltage, time_t now);
+
+/** Artemia batch task scheduler, runs every eligible task back to back.
+ *
+ * This works out, from a single voltage and time snapshot, every task that is
+ * due, within its delta, and with a minimum voltage below the current
+ * voltage, and runs them in the order of the configured policy. If there are
+ * more than the batch can hold, the ones first in policy order are kept.
+ * Tasks whose delta window has already passed are counted as missed, and
+ * rescheduled to their next scheduled time at or after now. Between tasks, only the
+ * voltage is re-read through the configured callback, and tasks whose minimum
+ * voltage is no longer met are skipped. So are tasks the configured prepare
+ * callback turns down. Every task that runs has its history updated to the
+ * snapshot time.
+ *
+ * If the configuration has a capacitor model, the voltage read after each
+ * task is used to update the task's energy estimate in scron. Instead of
+ * taking eligible tasks first come first served, the batch is then the set
+ * of tasks that fits in the energy available above the floor voltage,
+ * choosing the most tasks, and among those preferring the ones first in
+ * policy order (a 0/1 knapsack). Tasks with an unknown cost are assumed to be
+ * free until they are measured. With the LRU policy, the chosen tasks run
+ * highest minimum voltage first, while the storage is fullest.
+ *
+ * If scron keeps run statistics, every run, skip for lack of voltage, and
+ * missed delta window is recorded in them.
+ *
+ * @param[in,out] scron scron that manages the tasks to be run.
+ * @param[in] config Batch configuration.
+ * @param[in] voltage Current storage voltage level.
+ * @param[in] now The current time.
+ * @param[out] stats Statistics about this call. May be NULL.
+ *
+ * @returns The number of tasks that ran. If none ran, there are no more tasks
+ *  to schedule for the time being.
+ */
+size_t artemia_scheduler_batch(struct scron *scron,
+	const struct artemia_config *config, double voltage, time_t now,
+	struct artemia_stats *stats);
+
+/** Artemia batch task scheduler, as artemia_scheduler_batch, with the voltage
+ *  in millivolts.
+ *
+ * The scheduling decisions, energy model included, use integer math only. As
+ * long as the configuration reads the voltage with read_millivolts, or not at
+ * all, this never touches the FPU, only the tasks it runs might. The
+ * configuration's prepare_task callback runs before any of them, so it can
+ * turn the FPU on only when a task is about to run.
+ *
+ * @param[in,out] scron scron that manages the tasks to be run.
+ * @param[in] config Batch configuration.
+ * @param[in] voltage Current storage voltage level, in millivolts.
+ * @param[in] now The current time.
+ * @param[out] stats Statistics about this call. May be NULL.
+ *
+ * @returns The number of tasks that ran.
+ */
+size_t artemia_scheduler_batch_millivolts(struct scron *scron,
+	const struct artemia_config *config, uint32_t voltage, time_t now,
+	struct artemia_stats *stats);
+
+#endif//ARTEMIA_H_
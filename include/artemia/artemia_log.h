@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#ifndef ARTEMIA_LOG_H_
+#define ARTEMIA_LOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** Log levels. Logs above ARTEMIA_LOG_LEVEL are compiled out entirely. */
+#define ARTEMIA_LOG_LEVEL_NONE 0
+#define ARTEMIA_LOG_LEVEL_ERROR 1
+#define ARTEMIA_LOG_LEVEL_WARNING 2
+#define ARTEMIA_LOG_LEVEL_INFO 3
+#define ARTEMIA_LOG_LEVEL_DEBUG 4
+
+#ifndef ARTEMIA_LOG_LEVEL
+#define ARTEMIA_LOG_LEVEL ARTEMIA_LOG_LEVEL_INFO
+#endif
+
+/** Maximum number of arguments a log can have. */
+#define ARTEMIA_LOG_MAX_ARGUMENTS 8
+
+/** Magic number at the start of every flushed log, "ALOG" in the flush. */
+#define ARTEMIA_LOG_MAGIC UINT32_C(0x474F4C41)
+
+/** Version of the flushed log format. */
+#define ARTEMIA_LOG_VERSION 1
+
+/** Size of a flush header, in bytes. */
+#define ARTEMIA_LOG_HEADER_SIZE 12
+
+/** Tokenized logging.
+ *
+ * Formatting text on the device, and writing it out over a blocking UART,
+ * costs energy every wake. Instead, the format string of every log is placed
+ * in the artemia_log section, which the linker script keeps in the ELF but out
+ * of flash, and its offset in that section is the log's token. A log only
+ * appends its token and raw arguments to a buffer in RAM, and the buffer is
+ * flushed in bulk, e.g. to the UART before shutting down.
+ * tools/artemia_log.py reads the format strings back from the ELF, and turns
+ * flushed logs into text.
+ *
+ * Logs take a printf format string, and the compiler checks the arguments
+ * against it. Integer, floating point, and string (%s) arguments are
+ * supported. Every log is a single line.
+ *
+ * The flushed log is a header followed by the records, every field little
+ * endian:
+ *  - 4 bytes: ARTEMIA_LOG_MAGIC
+ *  - 1 byte: ARTEMIA_LOG_VERSION
+ *  - 1 byte: reserved, 0
+ *  - 2 bytes: size of the records, in bytes
+ *  - 4 bytes: number of logs dropped because the buffer was full
+ *
+ * Every record is a byte with the size of the rest of the record, the token
+ * as a varint, and the arguments in order. Integers are zigzag varints,
+ * floating point numbers 4 byte floats, and strings a length byte followed by
+ * the string.
+ */
+
+/** Type of a log argument. */
+enum artemia_log_type
+{
+	ARTEMIA_LOG_INTEGER,
+	ARTEMIA_LOG_REAL,
+	ARTEMIA_LOG_STRING,
+};
+
+/** Log argument, see ARTEMIA_LOG_ARGUMENT. */
+struct artemia_log_argument
+{
+	enum artemia_log_type type;
+	union
+	{
+		int64_t integer;
+		double real;
+		const char *string;
+	};
+};
+
+static inline struct artemia_log_argument artemia_log_integer(int64_t value)
+{
+	return (struct artemia_log_argument){ .type = ARTEMIA_LOG_INTEGER, .integer = value };
+}
+
+static inline struct artemia_log_argument artemia_log_real(double value)
+{
+	return (struct artemia_log_argument){ .type = ARTEMIA_LOG_REAL, .real = value };
+}
+
+static inline struct artemia_log_argument artemia_log_string(const char *value)
+{
+	return (struct artemia_log_argument){ .type = ARTEMIA_LOG_STRING, .string = value };
+}
+
+/** Wraps a value into a log argument, by its type. */
+#define ARTEMIA_LOG_ARGUMENT(value) _Generic((value), \
+	char *: artemia_log_string, \
+	const char *: artemia_log_string, \
+	float: artemia_log_real, \
+	double: artemia_log_real, \
+	default: artemia_log_integer)(value)
+
+// Wraps every argument after the format, each followed by a comma
+#define ARTEMIA_LOG_ARGUMENTS_0(f)
+#define ARTEMIA_LOG_ARGUMENTS_1(f, a) ARTEMIA_LOG_ARGUMENT(a),
+#define ARTEMIA_LOG_ARGUMENTS_2(f, a, b) ARTEMIA_LOG_ARGUMENTS_1(f, a) ARTEMIA_LOG_ARGUMENT(b),
+#define ARTEMIA_LOG_ARGUMENTS_3(f, a, b, c) ARTEMIA_LOG_ARGUMENTS_2(f, a, b) ARTEMIA_LOG_ARGUMENT(c),
+#define ARTEMIA_LOG_ARGUMENTS_4(f, a, b, c, d) ARTEMIA_LOG_ARGUMENTS_3(f, a, b, c) ARTEMIA_LOG_ARGUMENT(d),
+#define ARTEMIA_LOG_ARGUMENTS_5(f, a, b, c, d, e) ARTEMIA_LOG_ARGUMENTS_4(f, a, b, c, d) ARTEMIA_LOG_ARGUMENT(e),
+#define ARTEMIA_LOG_ARGUMENTS_6(f, a, b, c, d, e, g) ARTEMIA_LOG_ARGUMENTS_5(f, a, b, c, d, e) ARTEMIA_LOG_ARGUMENT(g),
+#define ARTEMIA_LOG_ARGUMENTS_7(f, a, b, c, d, e, g, h) ARTEMIA_LOG_ARGUMENTS_6(f, a, b, c, d, e, g) ARTEMIA_LOG_ARGUMENT(h),
+#define ARTEMIA_LOG_ARGUMENTS_8(f, a, b, c, d, e, g, h, i) ARTEMIA_LOG_ARGUMENTS_7(f, a, b, c, d, e, g, h) ARTEMIA_LOG_ARGUMENT(i),
+#define ARTEMIA_LOG_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, name, ...) name
+#define ARTEMIA_LOG_ARGUMENTS(...) ARTEMIA_LOG_SELECT(__VA_ARGS__, \
+	ARTEMIA_LOG_ARGUMENTS_8, ARTEMIA_LOG_ARGUMENTS_7, ARTEMIA_LOG_ARGUMENTS_6, \
+	ARTEMIA_LOG_ARGUMENTS_5, ARTEMIA_LOG_ARGUMENTS_4, ARTEMIA_LOG_ARGUMENTS_3, \
+	ARTEMIA_LOG_ARGUMENTS_2, ARTEMIA_LOG_ARGUMENTS_1, ARTEMIA_LOG_ARGUMENTS_0, \
+	unused)(__VA_ARGS__)
+#define ARTEMIA_LOG_FORMAT(format, ...) format
+
+/** Records a log, the format string followed by its arguments. The format
+ *  string is prefixed with a letter for the level, and never makes it into
+ *  flash. sizeof keeps the printf call, only there for the compiler to check
+ *  the format, from being evaluated.
+ */
+#define ARTEMIA_LOG_RECORD(level, ...) \
+	do \
+	{ \
+		__attribute__((section("artemia_log"), used)) \
+		static const char artemia_log_format_[] = \
+			level ARTEMIA_LOG_FORMAT(__VA_ARGS__, unused); \
+		const struct artemia_log_argument artemia_log_arguments_[] = { \
+			ARTEMIA_LOG_ARGUMENTS(__VA_ARGS__) {0} \
+		}; \
+		(void)sizeof(printf(__VA_ARGS__)); \
+		artemia_log_record(artemia_log_format_, artemia_log_arguments_, \
+			sizeof(artemia_log_arguments_) / sizeof(*artemia_log_arguments_) - 1); \
+	} while (0)
+
+#if ARTEMIA_LOG_LEVEL >= ARTEMIA_LOG_LEVEL_ERROR
+#define ARTEMIA_LOG_ERROR(...) ARTEMIA_LOG_RECORD("E", __VA_ARGS__)
+#else
+#define ARTEMIA_LOG_ERROR(...) do {} while (0)
+#endif
+
+#if ARTEMIA_LOG_LEVEL >= ARTEMIA_LOG_LEVEL_WARNING
+#define ARTEMIA_LOG_WARNING(...) ARTEMIA_LOG_RECORD("W", __VA_ARGS__)
+#else
+#define ARTEMIA_LOG_WARNING(...) do {} while (0)
+#endif
+
+#if ARTEMIA_LOG_LEVEL >= ARTEMIA_LOG_LEVEL_INFO
+#define ARTEMIA_LOG_INFO(...) ARTEMIA_LOG_RECORD("I", __VA_ARGS__)
+#else
+#define ARTEMIA_LOG_INFO(...) do {} while (0)
+#endif
+
+#if ARTEMIA_LOG_LEVEL >= ARTEMIA_LOG_LEVEL_DEBUG
+#define ARTEMIA_LOG_DEBUG(...) ARTEMIA_LOG_RECORD("D", __VA_ARGS__)
+#else
+#define ARTEMIA_LOG_DEBUG(...) do {} while (0)
+#endif
+
+/** Callback used to flush the log.
+ *
+ * @param[in] data User data passed to artemia_log_flush.
+ * @param[in] buffer Bytes to write.
+ * @param[in] size Number of bytes to write.
+ *
+ * @returns True on success, false otherwise.
+ */
+typedef bool (*artemia_log_write_callback)(void *data, const void *buffer, size_t size);
+
+/** Sets the buffer logs are recorded into. Until this is called, logs are
+ *  dropped without being counted, so hosts that don't care about them pay
+ *  nothing.
+ *
+ * @param[in] buffer Buffer to record logs into, which must outlive its use.
+ *  NULL stops recording.
+ * @param[in] capacity Size of the buffer in bytes, at most 65535.
+ */
+void artemia_log_init(uint8_t *buffer, size_t capacity);
+
+/** Records a log, use the ARTEMIA_LOG_* macros instead.
+ *
+ * If the buffer is full, the log is dropped and counted.
+ *
+ * @param[in] format Format string of the log, in the artemia_log section.
+ * @param[in] arguments Arguments of the log.
+ * @param[in] count Number of arguments, at most ARTEMIA_LOG_MAX_ARGUMENTS.
+ */
+void artemia_log_record(const char *format,
+	const struct artemia_log_argument *arguments, size_t count);
+
+/** Writes out every recorded log, and empties the buffer.
+ *
+ * Nothing is written if nothing was recorded or dropped.
+ *
+ * @param[in] write Callback to write the log with.
+ * @param[in] data User data passed to write.
+ *
+ * @returns True on success, false if writing failed, in which case the
+ *  buffer is left as it was.
+ */
+bool artemia_log_flush(artemia_log_write_callback write, void *data);
+
+#endif//ARTEMIA_LOG_H_
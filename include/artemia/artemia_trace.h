@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#ifndef ARTEMIA_TRACE_H_
+#define ARTEMIA_TRACE_H_
+
+#include <artemia.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/** Trace event types.
+ *
+ * Events ending in _BEGIN and _END bracket a span of time, and nest. The
+ * rest mark a single point in time. The argument of task events is the index
+ * of the task in scron.
+ *  - ARTEMIA_TRACE_SCHEDULER_BEGIN, ARTEMIA_TRACE_SCHEDULER_END: a call to
+ *    the batch scheduler. The end argument is the number of tasks that ran.
+ *  - ARTEMIA_TRACE_TASK_BEGIN, ARTEMIA_TRACE_TASK_END: a task running.
+ *  - ARTEMIA_TRACE_TASK_SELECTED: the scheduler chose a task for the batch.
+ *  - ARTEMIA_TRACE_TASK_SKIPPED: the scheduler skipped a task for lack of
+ *    voltage, or because the prepare callback turned it down.
+ *  - ARTEMIA_TRACE_TASK_MISSED: a task's delta window passed.
+ *  - ARTEMIA_TRACE_FS_MOUNT_BEGIN, ARTEMIA_TRACE_FS_MOUNT_END: mounting the
+ *    filesystem.
+ *  - ARTEMIA_TRACE_LOAD_BEGIN, ARTEMIA_TRACE_LOAD_END: loading the history.
+ *  - ARTEMIA_TRACE_SAVE_BEGIN, ARTEMIA_TRACE_SAVE_END: saving the history.
+ *  - ARTEMIA_TRACE_ALARM_BEGIN, ARTEMIA_TRACE_ALARM_END: planning and arming
+ *    the RTC alarm.
+ *  - ARTEMIA_TRACE_FFT_BEGIN, ARTEMIA_TRACE_FFT_END: an FFT.
+ *
+ * The values are part of the dump format, and tools/artemia_trace.py mirrors
+ * them, so new events must only be added at the end.
+ */
+enum artemia_trace_type
+{
+	ARTEMIA_TRACE_SCHEDULER_BEGIN = 1,
+	ARTEMIA_TRACE_SCHEDULER_END = 2,
+	ARTEMIA_TRACE_TASK_BEGIN = 3,
+	ARTEMIA_TRACE_TASK_END = 4,
+	ARTEMIA_TRACE_TASK_SELECTED = 5,
+	ARTEMIA_TRACE_TASK_SKIPPED = 6,
+	ARTEMIA_TRACE_TASK_MISSED = 7,
+	ARTEMIA_TRACE_FS_MOUNT_BEGIN = 8,
+	ARTEMIA_TRACE_FS_MOUNT_END = 9,
+	ARTEMIA_TRACE_LOAD_BEGIN = 10,
+	ARTEMIA_TRACE_LOAD_END = 11,
+	ARTEMIA_TRACE_SAVE_BEGIN = 12,
+	ARTEMIA_TRACE_SAVE_END = 13,
+	ARTEMIA_TRACE_ALARM_BEGIN = 14,
+	ARTEMIA_TRACE_ALARM_END = 15,
+	ARTEMIA_TRACE_FFT_BEGIN = 16,
+	ARTEMIA_TRACE_FFT_END = 17,
+};
+
+/** Trace event.
+ *  - timestamp: clock reading when the event was recorded, wrapping around
+ *  - type: an artemia_trace_type
+ *  - argument: event specific, 0 if unused
+ */
+struct artemia_trace_event
+{
+	uint32_t timestamp;
+	uint8_t type;
+	uint16_t argument;
+};
+
+/** Magic number at the start of every dump, "ATRC" in the dump. */
+#define ARTEMIA_TRACE_MAGIC UINT32_C(0x43525441)
+
+/** Version of the dump format. */
+#define ARTEMIA_TRACE_VERSION 1
+
+/** Size of a dump header, in bytes. */
+#define ARTEMIA_TRACE_HEADER_SIZE 28
+
+/** Size of a dumped event, in bytes. */
+#define ARTEMIA_TRACE_EVENT_SIZE 8
+
+/** Trace ring buffer.
+ *
+ * Events are recorded into a fixed buffer in RAM, as recording has to be
+ * cheap enough to not skew what is being measured. Once the buffer is full,
+ * the oldest events are overwritten. The buffer is meant to be dumped in bulk,
+ * e.g. to flash or the UART, once the interesting part is over.
+ *  - events: buffer events are recorded into
+ *  - capacity: number of events the buffer holds
+ *  - head: where the next event goes
+ *  - count: number of events in the buffer
+ *  - lost: number of events overwritten since the last dump
+ *  - read_clock: clock events are stamped with, e.g. a cycle counter. It may
+ *    wrap around
+ *  - clock_data: user data passed to read_clock
+ *  - clock_hz: frequency of the clock, so the dump can be decoded into time
+ */
+struct artemia_trace
+{
+	struct artemia_trace_event *events;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	uint32_t lost;
+	artemia_clock_callback read_clock;
+	void *clock_data;
+	uint32_t clock_hz;
+};
+
+/** Callback used to write a dump.
+ *
+ * @param[in] data User data passed to artemia_trace_dump.
+ * @param[in] buffer Bytes to write.
+ * @param[in] size Number of bytes to write.
+ *
+ * @returns True on success, false otherwise.
+ */
+typedef bool (*artemia_trace_write_callback)(void *data, const void *buffer, size_t size);
+
+/** Initializes a trace ring buffer.
+ *
+ * @param[out] trace Trace to initialize.
+ * @param[in] events Buffer to record events into, which must outlive the
+ *  trace.
+ * @param[in] capacity Number of events the buffer holds.
+ * @param[in] read_clock Clock to stamp events with.
+ * @param[in] clock_data User data passed to read_clock.
+ * @param[in] clock_hz Frequency of the clock.
+ */
+void artemia_trace_init(struct artemia_trace *trace,
+	struct artemia_trace_event *events, size_t capacity,
+	artemia_clock_callback read_clock, void *clock_data, uint32_t clock_hz);
+
+/** Records an event, stamped with the current clock reading.
+ *
+ * If the buffer is full, the oldest event is overwritten.
+ *
+ * @param[in,out] trace Trace to record to. If NULL, nothing is recorded, so
+ *  tracing can be compiled in and turned off.
+ * @param[in] type Type of the event.
+ * @param[in] argument Event specific argument.
+ */
+void artemia_trace_record(struct artemia_trace *trace,
+	enum artemia_trace_type type, uint16_t argument);
+
+/** Dumps every event in the buffer, oldest first, and empties it.
+ *
+ * The dump is a header followed by the events, every field little endian:
+ *  - 4 bytes: ARTEMIA_TRACE_MAGIC
+ *  - 1 byte: ARTEMIA_TRACE_VERSION
+ *  - 1 byte: ARTEMIA_TRACE_EVENT_SIZE
+ *  - 2 bytes: reserved, 0
+ *  - 4 bytes: clock frequency in Hz
+ *  - 8 bytes: time of the dump, signed seconds since the epoch
+ *  - 4 bytes: number of events
+ *  - 4 bytes: number of events lost to overwriting
+ *
+ * And per event, 4 bytes of timestamp, 1 byte of type, 1 reserved byte, and
+ * 2 bytes of argument. Dumps can be appended one after another, e.g. one per
+ * wake, and tools/artemia_trace.py decodes them.
+ *
+ * @param[in,out] trace Trace to dump.
+ * @param[in] time The current time, to place the dump on a timeline.
+ * @param[in] write Callback to write the dump with.
+ * @param[in] data User data passed to write.
+ *
+ * @returns True on success, false if writing failed, in which case the
+ *  buffer is left as it was.
+ */
+bool artemia_trace_dump(struct artemia_trace *trace, time_t time,
+	artemia_trace_write_callback write, void *data);
+
+#endif//ARTEMIA_TRACE_H_
@@ -6,23 +6,93 @@
 
 #include <time.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 // FIXME what is data?
 typedef int (*scron_task_function)(void *data);
 
+/** Time returned for schedules that will never fire again. */
+#define SCRON_NEVER ((time_t)INT64_MAX)
+
+/** Bitmask with only bit n set, for use in scron_cron masks. */
+#define SCRON_CRON_BIT(n) (UINT64_C(1) << (n))
+
+/** Bitmask with bits low through high (inclusive) set, for use in scron_cron
+ *  masks.
+ */
+#define SCRON_CRON_RANGE(low, high) \
+	((((UINT64_C(2) << (high)) - 1)) & ~(SCRON_CRON_BIT(low) - 1))
+
+#define SCRON_CRON_ALL_SECONDS SCRON_CRON_RANGE(0, 59)
+#define SCRON_CRON_ALL_MINUTES SCRON_CRON_RANGE(0, 59)
+#define SCRON_CRON_ALL_HOURS SCRON_CRON_RANGE(0, 23)
+#define SCRON_CRON_ALL_DAYS SCRON_CRON_RANGE(1, 31)
+#define SCRON_CRON_ALL_MONTHS SCRON_CRON_RANGE(1, 12)
+#define SCRON_CRON_ALL_WEEKDAYS SCRON_CRON_RANGE(0, 6)
+
+/** scron_cron flag: a day matches if either the day of the month or the day
+ *  of the week matches, instead of requiring both to match. This is what cron
+ *  does when both fields are restricted.
+ */
+#define SCRON_CRON_DAY_OR 0x01
+
+/** scron cron-style schedule, compiled to bitmasks.
+ *
+ * Each mask has bit n set if the schedule fires when that field is n. Times
+ * are in UTC. A time matches the schedule when its second, minute, hour and
+ * month all match, and its day matches. A day matches when both the day of
+ * the month and the day of the week match, or if the SCRON_CRON_DAY_OR flag
+ * is set, when either of them matches.
+ *  - seconds: bits 0-59
+ *  - minutes: bits 0-59
+ *  - hours: bits 0-23
+ *  - days: day of the month, bits 1-31
+ *  - months: bits 1-12
+ *  - weekdays: day of the week, bits 0-6, Sunday is 0
+ *  - flags: SCRON_CRON_* flags
+ *
+ * For example, every 15 seconds from 06:00 through 17:59, Monday through
+ * Friday, is the cron expression "0/15 * 6-17 * * 1-5".
+ */
+struct scron_cron
+{
+	uint64_t seconds;
+	uint64_t minutes;
+	uint32_t hours;
+	uint32_t days;
+	uint16_t months;
+	uint8_t weekdays;
+	uint8_t flags;
+};
+
 /** scron schedule.
  *
- * This describes when a task/event should take place. Negative numbers are
- * ignored. Scheduled events take place when all non-negative elements match
- * the current time. For example, for a structure where only the minute element
- * is non-negative, this scheduled event will fire every hour when the system
- * clock matches the minute value in the schedule.
+ * This describes when a task/event should take place.
+ *
+ * If period is non-zero, the schedule fires every period seconds, phase
+ * seconds after every multiple of period since the epoch, and the rest of the
+ * fields are ignored. This is precomputed by tools/scron_tasks.py for cron
+ * schedules that fire at a fixed interval, so the next time is a single
+ * modulo operation.
+ *
+ * Otherwise, if the cron schedule has any seconds set, it is used and the
+ * rest of the fields are ignored.
+ *
+ * Otherwise, negative numbers are ignored. Scheduled events take place when
+ * all non-negative elements match the current time. For example, for a
+ * structure where only the minute element is non-negative, this scheduled
+ * event will fire every hour when the system clock matches the minute value
+ * in the schedule.
  */
 struct scron_schedule
 {
 	int8_t hour;
 	int8_t minute;
 	int8_t second;
+	struct scron_cron cron;
+	uint32_t period;
+	uint32_t phase;
 };
 
 /** scron task control structure.
@@ -30,39 +100,237 @@ struct scron_schedule
  * scron allows for tasks to be registered to be run when their schedule
  * dictates. This struct contains static metadata about the task including:
  *  - name: Name of the task, less than 31 characters long
- *  - minimum_voltage: the empirically derived safe voltage at which the task
- *    should terminate before expending all available energy.
+ *  - minimum_millivolts: the empirically derived safe voltage at which the
+ *    task should terminate before expending all available energy, in
+ *    millivolts, so checking it needs no floating point math.
  *  - function: the pointer to the actual task function
  *  - schedule: the schedule describing when the task should run
  *  - exact_timing: indicating whether the task should only be run at specific
  *    times, or just any time after the schedule is triggered.
+ *  - flags: SCRON_TASK_* flags describing what the task needs to run
  */
 struct scron_task
 {
 	char name[32];
-	double minimum_voltage;
+	uint16_t minimum_millivolts;
 	scron_task_function function;
 	struct scron_schedule schedule;
 	time_t delta;
+	uint32_t flags;
 };
 
+/** scron_task flag: the task uses the filesystem, so it must be mounted
+ *  before the task runs.
+ */
+#define SCRON_TASK_NEEDS_FS 0x01
+
 /** scron task history structure.
  *
  * This structure is meant to contain non-static information regarding tasks.
  * These should be written to non-volatile or persistent memory.
+ *  - last_run: the last time the task ran
+ *  - next_run: the next time the task should run, cached so it is only
+ *    worked out from the schedule when the task runs, is rescheduled, the
+ *    clock jumps, or the schedule changes between builds. It is only trusted
+ *    if it is after last_run, so 0 has it worked out again.
+ *  - energy: running estimate of the energy the task uses from the storage
+ *    capacitor each time it runs, in microjoules. 0 if it is unknown.
  */
 struct scron_task_history
 {
 	time_t last_run;
+	time_t next_run;
+	uint32_t energy;
+};
+
+/** Number of buckets in the lateness histogram of scron_task_stats. */
+#define SCRON_LATENESS_BUCKETS 8
+
+/** scron task run statistics.
+ *
+ * These are fixed-size, and persisted along with the history when enabled
+ * with scron_enable_stats. Counters saturate instead of wrapping around.
+ *  - runs: number of times the task ran
+ *  - lateness: histogram of how many seconds after its scheduled time the
+ *    task ran. Bucket 0 counts runs on time, bucket i runs 2^(i-1) through
+ *    2^i - 1 seconds late, and the last bucket everything later than that
+ *  - duration_min, duration_max: shortest and longest run, in milliseconds
+ *  - duration_total: time spent running the task, in milliseconds, so the
+ *    mean duration is duration_total / runs
+ *  - voltage_min: lowest storage voltage the task was dispatched at, in
+ *    millivolts
+ *  - voltage_average: running average of the storage voltage the task was
+ *    dispatched at, in millivolts, with the newest run weighing a quarter
+ *  - voltage_skips: times the task was due, but skipped because the storage
+ *    voltage was below its minimum
+ *  - missed: times the task missed its delta window
+ */
+struct scron_task_stats
+{
+	uint32_t runs;
+	uint16_t lateness[SCRON_LATENESS_BUCKETS];
+	uint16_t duration_min;
+	uint16_t duration_max;
+	uint32_t duration_total;
+	uint16_t voltage_min;
+	uint16_t voltage_average;
+	uint32_t voltage_skips;
+	uint32_t missed;
 };
 
-/** scron tasks table. */
+/** scron tasks table.
+ *
+ * The tasks are constant, so a static table can live in flash.
+ */
 struct scron_tasks
+{
+	size_t size;
+	const struct scron_task *tasks;
+};
+
+/** scron runtime tasks table, owned and modified by scron. */
+struct scron_runtime_tasks
 {
 	size_t size;
 	struct scron_task *tasks;
 };
 
+/** scron task queue.
+ *
+ * This is an indexed binary min-heap of the next time each task should run.
+ * Tasks are referred to by their scron index (static tasks first, then runtime
+ * tasks). The heap is only updated when a task runs or is added, so finding
+ * the next task to run is O(1), and updating it is O(log n).
+ *  - heap: task indices, ordered so that heap[0] is the next task to run
+ *  - position: for every task index, its position in the heap
+ *  - next: for every task index, the next time the task should run
+ */
+struct scron_queue
+{
+	size_t *heap;
+	size_t *position;
+	time_t *next;
+};
+
+/** scron run order.
+ *
+ * This is the order in which tasks last ran, least recently run first. It is
+ * kept up to date incrementally, as only the task that just ran moves to the
+ * back of the order.
+ *  - order: task indices, least recently run first
+ *  - rank: for every task index, its position in order
+ */
+struct scron_run_order
+{
+	size_t *order;
+	size_t *rank;
+};
+
+/** Name index slot index marking an empty slot. */
+#define SCRON_NAME_EMPTY UINT32_MAX
+
+/** scron task name index slot.
+ *  - hash: hash of the task name, see scron_hash_name
+ *  - index: index of the task, or SCRON_NAME_EMPTY if the slot is empty
+ */
+struct scron_name_slot
+{
+	uint32_t hash;
+	uint32_t index;
+};
+
+/** scron task name index.
+ *
+ * This is an open addressing (linear probing) hash table from task names to
+ * task indices, so tasks can be found by name in O(1). It has a power of two
+ * number of slots, at least twice the number of tasks, and is only
+ * reallocated when it needs to grow.
+ *  - slots: the table
+ *  - capacity: number of slots
+ */
+struct scron_name_index
+{
+	struct scron_name_slot *slots;
+	size_t capacity;
+};
+
+/** scron task handle.
+ *
+ * Task indices change when tasks are removed, but handles do not. A handle
+ * stays valid until the task it refers to is removed, after which the
+ * generation of its slot no longer matches, and the handle is rejected.
+ *  - slot: slot in the scron handle table
+ *  - generation: generation of the slot when the handle was made
+ */
+struct scron_handle
+{
+	uint32_t slot;
+	uint32_t generation;
+};
+
+/** Handle slot value for handles that refer to no task. */
+#define SCRON_HANDLE_INVALID UINT32_MAX
+
+/** scron handle table slot.
+ *  - index: index of the task in the slot, or if the slot is free, the next
+ *    free slot (SCRON_HANDLE_INVALID if none)
+ *  - generation: incremented every time the task in the slot is removed
+ */
+struct scron_handle_slot
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+/** scron handle table.
+ *  - slots: handle slots, with room for as many slots as there are tasks
+ *  - task_slot: for every task index, the slot referring to it
+ *  - count: number of slots ever used
+ *  - free: first free slot, or SCRON_HANDLE_INVALID if none
+ */
+struct scron_handles
+{
+	struct scron_handle_slot *slots;
+	uint32_t *task_slot;
+	uint32_t count;
+	uint32_t free;
+};
+
+/** scron history dirty tracking.
+ *
+ * Tracks what changed since the history was last persisted, so it can be
+ * saved incrementally.
+ *  - entries: for every task, whether its history changed
+ *  - layout: whether tasks were added or removed, which moves history
+ *    entries around
+ */
+struct scron_dirty
+{
+	bool *entries;
+	bool layout;
+};
+
+/** scron hot task data.
+ *
+ * The few task fields the scheduler checks every wake, for every task, are
+ * kept in parallel arrays by task index, static and runtime tasks alike, so
+ * scanning them doesn't walk every scron_task and branch on which table it is
+ * in. Along with the next run times in the queue, these are all scron_scan
+ * reads. They are kept in sync as tasks are added and removed.
+ *  - minimum_voltage: for every task index, the task's minimum voltage, in
+ *    millivolts, as in minimum_millivolts
+ *  - window: for every task index, seconds after its next run the task
+ *    misses it (its delta), or SCRON_NEVER if it has no delta
+ *  - state: for every task index, its scron_scan_state as of the last
+ *    scron_scan
+ */
+struct scron_hot
+{
+	uint16_t *minimum_voltage;
+	time_t *window;
+	uint8_t *state;
+};
+
 /** scron control structure.
  *
  * This contains two tables of tasks-- a static one that is meant to exist in
@@ -72,17 +340,27 @@ struct scron_tasks
 struct scron
 {
 	struct scron_tasks static_tasks;
-	struct scron_tasks runtime_tasks;
+	struct scron_runtime_tasks runtime_tasks;
 	size_t runtime_capacity;
 	struct scron_task_history *history;
+	struct scron_task_stats *stats;
+	struct scron_queue queue;
+	struct scron_run_order run_order;
+	struct scron_name_index names;
+	struct scron_handles handles;
+	struct scron_dirty dirty;
+	struct scron_hot hot;
 };
 
 /** Initializes the scron object.
  *
  * @param[out] scron scron object to initialize.
  * @param[in] static_tasks Pointer to the constant/compile-time tasks in memory.
+ *
+ * @returns True on success, false if memory could not be allocated, in which
+ *  case there is nothing to delete.
  */
-void scron_init(struct scron *scron, struct scron_tasks *static_tasks);
+bool scron_init(struct scron *scron, const struct scron_tasks *static_tasks);
 
 /** Releases any resources being used by scron.
  *
@@ -94,17 +372,49 @@ void scron_delete(struct scron *scron);
  *
  * @param[in,out] scron scron object to add the task to.
  * @param[in] scron_task Task structure to copy into the runtime table.
+ *
+ * @returns A handle to the new task, or if memory could not be allocated, a
+ *  handle with a slot of SCRON_HANDLE_INVALID, which never resolves. scron is
+ *  then left as it was.
  */
-void scron_add_task(struct scron *scron,
+struct scron_handle scron_add_task(struct scron *scron,
 	const struct scron_task *task);
 
-//FIXME what if we fail, or ask for a bad index?
 /** Removes a task from the runtime task table.
+ *
+ * This is O(log n). The last runtime task is moved into the removed task's
+ * index, along with its history, so task indices are not stable across
+ * removals. Use handles to keep track of tasks instead. Handles to the
+ * removed task become invalid.
  *
  * @param[in,out] scron scron object to remove the task from.
  * @param[in] index scron task index to remove.
+ *
+ * @returns True if the task was removed, false if the index is not a valid
+ *  runtime task index. Static tasks can't be removed.
+ */
+bool scron_del_task(struct scron *scron, size_t index);
+
+/** Gets a handle to the task at the given index.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] index Index of the task. Must be valid.
+ *
+ * @returns A handle to the task.
  */
-void scron_del_task(struct scron *scron, size_t index);
+struct scron_handle scron_get_handle(const struct scron *scron, size_t index);
+
+/** Finds the current index of the task a handle refers to.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] handle Handle to resolve.
+ * @param[out] index Index of the task, only written to on success.
+ *
+ * @returns True if the handle refers to a task, false if the task was removed
+ *  or the handle is invalid.
+ */
+bool scron_resolve_handle(const struct scron *scron, struct scron_handle handle,
+	size_t *index);
 
 /** Gets the number of scron tasks in total (static and runtime).
  *
@@ -124,32 +434,391 @@ size_t scron_get_task_count(const struct scron *scron);
  */
 time_t scron_schedule_next_time(const struct scron_schedule *sched, time_t now);
 
+/** Compiles a cron expression into a cron schedule.
+ *
+ * The expression has six whitespace separated fields, in order: second,
+ * minute, hour, day of the month, month, and day of the week. Each field is a
+ * comma separated list of items, and each item is either `*`, a number `N`,
+ * or a range `N-M`, optionally followed by a step `/S`. `N/S` is short for
+ * `N-max/S`. Only numbers are supported, not names. Day of the week 7 is also
+ * Sunday.
+ *
+ * @param[out] cron Cron schedule to compile into. Only written to on success.
+ * @param[in] expression Cron expression to compile.
+ *
+ * @returns True if the expression was valid, false otherwise.
+ */
+bool scron_cron_parse(struct scron_cron *cron, const char *expression);
+
+/** Computes the next time a cron schedule fires, strictly after the given
+ *  time.
+ *
+ * @param[in] cron Cron schedule to use.
+ * @param[in] now Time to search from.
+ *
+ * @returns The time_t of the next time the schedule fires, or SCRON_NEVER if
+ *  it never fires again (e.g. it only fires on February 30th).
+ */
+time_t scron_cron_next_time(const struct scron_cron *cron, time_t now);
+
+/** Computes the next time each task in an array should run, based on the time
+ *  each task last ran.
+ *
+ * This is the batch version of scron_schedule_next_time, computing all of the
+ * next times in a single pass over the task and history arrays.
+ *
+ * @param[in] tasks Array of tasks with the schedules to use.
+ * @param[in] count Number of tasks in the array.
+ * @param[in] history History of each task, in the same order as tasks.
+ * @param[out] next Array of at least count elements where the next time each
+ *  task should run is written to.
+ */
+void scron_schedule_next_times(const struct scron_task *tasks, size_t count,
+	const struct scron_task_history *history, time_t *next);
+
 /** Computes the next time the event should occur based on the time the tasks
  *  last ran.
  *
+ * This is O(1), as it only peeks at the top of the scron task queue.
+ *
  * @param[in] scron scron to use.
  *
- * @returns The time_t when the next scheduled event should take place. FIXME do I want to return which task too???
+ * @returns The time_t when the next scheduled event should take place, or 0
+ *  if there are no tasks.
  */
 time_t scron_next_time(const struct scron *scron);
 
+/** Gets the index of the task that should run next.
+ *
+ * @param[in] scron scron to query.
+ *
+ * @returns The index of the task with the earliest next run time, or the
+ *  total number of tasks if there are none.
+ */
+size_t scron_next_task(const struct scron *scron);
+
+/** Computes the end of the window a task may run in when coalescing wakes.
+ *
+ * The window starts at the next time the task should run, and ends tolerance
+ * seconds after it, or just before the task would miss its delta, whichever
+ * comes first.
+ *
+ * @param[in] task Task to query.
+ * @param[in] next Next time the task should run.
+ * @param[in] tolerance Longest the task may be delayed, in seconds.
+ *
+ * @returns The last time the task may run at, or SCRON_NEVER if next is too
+ *  far in the future to add to.
+ */
+time_t scron_task_window_end(const struct scron_task *task, time_t next,
+	time_t tolerance);
+
+/** Computes the next time to wake up, coalescing tasks that are due close
+ *  together into a single wake.
+ *
+ * Each task may run in the window given by scron_task_window_end. Tasks are
+ * merged into the wake in order of their next run time, for as long as their
+ * windows all overlap, and the wake is at the latest next run time among
+ * them. Every task whose next run time is at or before the wake is due
+ * then, so they are exactly the tasks in the set.
+ *
+ * This is O(k log k) in the number k of tasks due within the window of the
+ * next task to run, and does not allocate.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] tolerance Longest any task may be delayed to share a wake, in
+ *  seconds. 0 only merges tasks due at the same time.
+ * @param[out] wake The time to wake up, 0 if there are no tasks, or
+ *  SCRON_NEVER if no task will run again.
+ * @param[out] tasks Array the indices of the tasks to run at the wake are
+ *  written to, in order of their next run time.
+ * @param[in] capacity Number of elements in tasks, at least 1. If more tasks
+ *  are due close together, only the first capacity tasks are merged.
+ *
+ * @returns The number of tasks written to tasks.
+ */
+size_t scron_next_wake(const struct scron *scron, time_t tolerance,
+	time_t *wake, size_t *tasks, size_t capacity);
+
+/** Joins tasks into a single wake, the way scron_next_wake does.
+ *
+ * Tasks join in the order given, for as long as the next run time of each
+ * falls within the window of every task that joined before it. This is for
+ * predicting wakes from next run times other than the current ones, see
+ * scron_alarm_plan.
+ *
+ * @param[in] scron scron with the tasks.
+ * @param[in] tolerance Longest any task may be delayed to share a wake, in
+ *  seconds.
+ * @param[in] next Next run time of every task, by task index.
+ * @param[in] tasks Indices of the tasks that may join, sorted by next run
+ *  time.
+ * @param[in] count Number of elements in tasks, at least 1.
+ * @param[out] wake The time to wake up, the next run time of the last task
+ *  to join.
+ *
+ * @returns The number of tasks that join, the first ones in tasks.
+ */
+size_t scron_join_wake(const struct scron *scron, time_t tolerance,
+	const time_t *next, const size_t *tasks, size_t count, time_t *wake);
+
+/** Gets the next time the task at the given index should run.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] index Index of the task to query. Must be valid.
+ *
+ * @returns The time_t when the task should run next.
+ */
+time_t scron_get_next_run(const struct scron *scron, size_t index);
+
+/** Skips a task's missed runs, moving its next run to its first scheduled
+ *  time at or after now, without running it.
+ *
+ * Its last run and place in the run order are left untouched, and the new
+ * next run is cached in its history. Snapshots keep it, but scron_save does
+ * not.
+ *
+ * @param[in,out] scron scron to update.
+ * @param[in] index Index of the task to update. Must be valid.
+ * @param[in] now The current time.
+ */
+void scron_reschedule(struct scron *scron, size_t index, time_t now);
+
+/** Works out the next run of every task again, from the time it last ran.
+ *
+ * Next runs are cached in the history, and only updated when a task runs or
+ * is rescheduled. Call this when the clock jumps, as a next run cached before
+ * the jump, e.g. after skipping missed runs, may no longer make sense. This
+ * marks all of the history dirty.
+ *
+ * @param[in,out] scron scron to update.
+ */
+void scron_invalidate_next_runs(struct scron *scron);
+
+/** Records a measurement of the energy a task used when it ran.
+ *
+ * This folds the measurement into the running estimate of the energy the task
+ * uses, in its history.
+ *
+ * @param[in,out] scron scron to update.
+ * @param[in] index Index of the task to update. Must be valid.
+ * @param[in] energy Energy used by the task, in microjoules.
+ */
+void scron_record_energy(struct scron *scron, size_t index, uint32_t energy);
+
+/** State of a task as of the last scron_scan.
+ *  - SCRON_SCAN_WAITING: the task isn't due yet
+ *  - SCRON_SCAN_DUE: the task is due, within its delta, and its minimum
+ *    voltage is met
+ *  - SCRON_SCAN_LOW_VOLTAGE: the task is due and within its delta, but the
+ *    voltage is below its minimum
+ *  - SCRON_SCAN_MISSED: the task's delta window passed
+ */
+enum scron_scan_state
+{
+	SCRON_SCAN_WAITING = 0,
+	SCRON_SCAN_DUE = 1,
+	SCRON_SCAN_LOW_VOLTAGE = 2,
+	SCRON_SCAN_MISSED = 3,
+};
+
+/** Classifies every task by whether it can run now.
+ *
+ * This is a single branch-free pass over the hot task data, which the
+ * compiler can vectorize. The state of every task is then available through
+ * scron_get_scan_state, until the next scan.
+ *
+ * @param[in,out] scron scron to scan.
+ * @param[in] now The current time.
+ * @param[in] voltage Current storage voltage, in millivolts.
+ *
+ * @returns The number of tasks that aren't waiting.
+ */
+size_t scron_scan(struct scron *scron, time_t now, uint32_t voltage);
+
+/** Classifies a single task by whether it can run now, like scron_scan.
+ *
+ * This is for callers that stop at the first few tasks that can run, for
+ * which scanning every task costs more than it saves.
+ *
+ * @param[in,out] scron scron to scan.
+ * @param[in] index Index of the task to classify. Must be valid.
+ * @param[in] now The current time.
+ * @param[in] voltage Current storage voltage, in millivolts.
+ *
+ * @returns The state of the task, which scron_get_scan_state also returns
+ *  until the next scan.
+ */
+enum scron_scan_state scron_scan_task(struct scron *scron, size_t index,
+	time_t now, uint32_t voltage);
+
+/** Gets the state of a task as of the last scron_scan.
+ *
+ * Tasks added since the last scan are waiting.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] index Index of the task to query. Must be valid.
+ *
+ * @returns The state of the task.
+ */
+enum scron_scan_state scron_get_scan_state(const struct scron *scron, size_t index);
+
+/** Gets the index of the task at the given position in the run order.
+ *
+ * Position 0 is the least recently run task, and the last position is the
+ * task that ran most recently.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] position Position in the run order. Must be valid.
+ *
+ * @returns The index of the task at that position.
+ */
+size_t scron_get_run_order(const struct scron *scron, size_t position);
+
+/** Updates the time the task at the given index last ran.
+ *
+ * This updates the task history, the position of the task in the scron task
+ * queue, and moves the task to the back of the run order, as the most
+ * recently run task. Code should use this instead of writing to the history
+ * directly, else the queue and run order will get out of sync.
+ *
+ * @param[in,out] scron scron to update.
+ * @param[in] index Index of the task to update. Must be valid.
+ * @param[in] last_run The time the task last ran.
+ */
+void scron_set_last_run(struct scron *scron, size_t index, time_t last_run);
+
+/** Enables keeping run statistics for every task.
+ *
+ * Statistics are off by default, as they make every snapshot entry larger,
+ * e.g. too large for the whole snapshot to fit in RTC RAM. Once enabled, they
+ * are saved and loaded along with the history. This marks all of the history
+ * dirty, as the snapshot layout changes.
+ *
+ * @param[in,out] scron scron to enable statistics for.
+ *
+ * @returns True on success, or if they were already enabled, false if memory
+ *  could not be allocated.
+ */
+bool scron_enable_stats(struct scron *scron);
+
+/** Gets the run statistics of a task.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] index Index of the task. Must be valid.
+ *
+ * @returns The statistics of the task, or NULL if statistics are not enabled.
+ */
+const struct scron_task_stats *scron_get_stats(const struct scron *scron, size_t index);
+
+/** Records a run of a task in its statistics.
+ *
+ * This does nothing if statistics are not enabled.
+ *
+ * @param[in,out] scron scron to update.
+ * @param[in] index Index of the task that ran. Must be valid.
+ * @param[in] lateness Seconds after its scheduled time the task ran.
+ * @param[in] duration How long the task ran, in milliseconds.
+ * @param[in] voltage Storage voltage when the task was dispatched, in
+ *  millivolts.
+ */
+void scron_record_run(struct scron *scron, size_t index, time_t lateness,
+	uint32_t duration, uint32_t voltage);
+
+/** Records that a task was due, but skipped for lack of voltage.
+ *
+ * This does nothing if statistics are not enabled.
+ *
+ * @param[in,out] scron scron to update.
+ * @param[in] index Index of the skipped task. Must be valid.
+ */
+void scron_record_voltage_skip(struct scron *scron, size_t index);
+
+/** Records that a task missed its delta window.
+ *
+ * This does nothing if statistics are not enabled.
+ *
+ * @param[in,out] scron scron to update.
+ * @param[in] index Index of the task that missed. Must be valid.
+ */
+void scron_record_miss(struct scron *scron, size_t index);
+
+/** Marks the history of a task as changed since it was last persisted.
+ *
+ * scron does this itself for every change it makes to the history. Code
+ * writing to the history directly must call this.
+ *
+ * @param[in,out] scron scron to update.
+ * @param[in] index Index of the task whose history changed. Must be valid.
+ */
+void scron_mark_dirty(struct scron *scron, size_t index);
+
+/** Checks whether the history of a task changed since it was last persisted.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] index Index of the task. Must be valid.
+ *
+ * @returns True if the history of the task changed, false otherwise.
+ */
+bool scron_is_dirty(const struct scron *scron, size_t index);
+
+/** Checks whether tasks were added or removed since the history was last
+ *  persisted.
+ *
+ * When they have, history entries may have moved between indices, so the
+ * whole history must be persisted.
+ *
+ * @param[in] scron scron to query.
+ *
+ * @returns True if tasks were added or removed, false otherwise.
+ */
+bool scron_is_layout_dirty(const struct scron *scron);
+
+/** Marks all of the history as persisted.
+ *
+ * @param[in,out] scron scron to update.
+ */
+void scron_clear_dirty(struct scron *scron);
+
 /** Gets the scron task at the given index.
  *
- * @param[in,out] scron scron to query.
+ * @param[in] scron scron to query.
  * @param[in] index Index of the task to retrieve.
  *
  * @returns A pointer to a task if the index is valid, NULL otherwise.
  */
-struct scron_task *scron_get_task(struct scron *scron, size_t index);
+const struct scron_task *scron_get_task(const struct scron *scron, size_t index);
+
+/** Hashes a task name, as used by the scron task name index.
+ *
+ * This is 32-bit FNV-1a.
+ *
+ * @param[in] name Name to hash.
+ *
+ * @returns The hash of the name.
+ */
+uint32_t scron_hash_name(const char *name);
+
+/** Finds the index of the scron task with the given name.
+ *
+ * This is O(1), using the scron task name index.
+ *
+ * @param[in] scron scron to query.
+ * @param[in] name Name of the task to find.
+ *
+ * @returns The index of the task if the name was matched, or the total number
+ *  of tasks if not.
+ */
+size_t scron_find_task(const struct scron *scron, const char *name);
 
 /** Gets the scron task with the given name.
  *
- * @param[in,out] scron scron to query.
+ * @param[in] scron scron to query.
  * @param[in] name Name of the task to get.
  *
  * @returns A pointer to the task if the name was matched, NULL otherwise.
  */
-struct scron_task *scron_get_task_by_name(struct scron *scron, const char *name);
+const struct scron_task *scron_get_task_by_name(const struct scron *scron, const char *name);
 
 /** Callback called by save to save the key,value pair of {name: last_run}
  *  somewhere. The specific details of saving are left to the callback to
@@ -161,6 +830,9 @@ struct scron_task *scron_get_task_by_name(struct scron *scron, const char *name)
 typedef void (*scron_save_callback)(const char *name, time_t last_run);
 
 /** Saves the scron history through the use of a save callback function.
+ *
+ * Only last runs are saved. Cached next runs, including those moved by
+ * scron_reschedule, are lost, see scron_load.
  *
  * @param[in] scron The scron with the data to save.
  * @param[in] callback A function that accepts a (name, time) pair to save the
@@ -180,10 +852,262 @@ typedef void (*scron_load_callback)(const char *name, time_t *last_run);
 
 /** Loads the scron history through the use of a load callback function.
  *
- * @param[in] scron The scron to load.
+ * The scron task queue and run order are rebuilt after all of the history is
+ * loaded, working out the next run of every task from its last run.
+ *
+ * As only last runs are stored, a task that was rescheduled past a missed
+ * window is due at that window again after loading, and is counted as having
+ * missed it on every load until it runs. Where that matters, e.g. when every
+ * wake is a cold boot, persist the history with scron_serialize or a
+ * scron_storage backend instead, which keep the next runs.
+ *
+ * @param[in,out] scron The scron to load.
  * @param[in] callback A function that takes a task name, and modifies the
  *  provided pointer if found in storage.
  */
-void scron_load(const struct scron *scron, scron_load_callback callback);
+void scron_load(struct scron *scron, scron_load_callback callback);
+
+/** Recomputes the scron task queue and run order from the history.
+ *
+ * Call this after modifying scron->history directly, e.g. after restoring it
+ * from storage without scron_load. Cached next runs are kept, so set next_run
+ * to 0 in the history of any task whose last_run changed.
+ *
+ * @param[in,out] scron The scron to refresh.
+ */
+void scron_refresh(struct scron *scron);
+
+/** Magic number at the start of serialized scron snapshots, "SCRS". */
+#define SCRON_SNAPSHOT_MAGIC UINT32_C(0x53524353)
+
+/** Current version of the serialized scron snapshot format. */
+#define SCRON_SNAPSHOT_VERSION 1
+
+/** Size of the serialized scron snapshot header, in bytes. */
+#define SCRON_SNAPSHOT_HEADER_SIZE 20
+
+/** Size of each serialized scron snapshot entry without statistics, in bytes. */
+#define SCRON_SNAPSHOT_ENTRY_SIZE 22
+
+/** Size of each serialized scron snapshot entry with statistics, in bytes. */
+#define SCRON_SNAPSHOT_STATS_ENTRY_SIZE 62
+
+/** Serialized scron snapshot flag: entries have statistics. */
+#define SCRON_SNAPSHOT_STATS 0x0001
+
+/** Serialized scron snapshot view.
+ *
+ * A snapshot holds the history of every task, along with the task names to
+ * match it back to tasks. It is laid out as:
+ *
+ *  - header: magic (uint32_t), version (uint16_t), entry size (uint16_t),
+ *    number of tasks (uint16_t), SCRON_SNAPSHOT_* flags (uint16_t), size of
+ *    the whole snapshot (uint32_t), CRC-32 of the whole snapshot except for
+ *    the CRC itself (uint32_t)
+ *  - entries: for every task, its last run time (int64_t), its energy
+ *    estimate (uint32_t), the offset of its name in the name table
+ *    (uint32_t), its cached next run time as an offset from its last run time
+ *    (uint32_t, 0 if unknown), and the fingerprint of its schedule when it
+ *    was saved (uint16_t), see scron_schedule_fingerprint. If the
+ *    SCRON_SNAPSHOT_STATS flag is set, followed by its statistics, every
+ *    field of scron_task_stats in order.
+ *  - name table: every task name, NUL terminated
+ *
+ * All integers are little endian. Newer versions may only add fields to the
+ * end of the entries, so readers can skip them using the entry size.
+ * Statistics are only written when they are enabled.
+ *
+ * A view refers to the snapshot in place, without copying or allocating.
+ *  - data: the snapshot
+ *  - size: size of the snapshot in bytes
+ *  - count: number of tasks in the snapshot
+ *  - entry_size: size of each entry in bytes
+ *  - version: format version the snapshot was written with
+ *  - flags: SCRON_SNAPSHOT_* flags
+ */
+struct scron_snapshot
+{
+	const uint8_t *data;
+	size_t size;
+	uint16_t count;
+	uint16_t entry_size;
+	uint16_t version;
+	uint16_t flags;
+};
+
+/** Computes a fingerprint of a schedule, which changes if the schedule does.
+ *
+ * Snapshots store it with every cached next run time, which is only trusted
+ * when loaded if the schedule of the task still has the same fingerprint.
+ * Otherwise, e.g. if a static task changed its schedule, but not its name,
+ * between builds, it is worked out again.
+ *
+ * @param[in] sched Schedule to fingerprint.
+ *
+ * @returns The fingerprint.
+ */
+uint16_t scron_schedule_fingerprint(const struct scron_schedule *sched);
+
+/** Computes the CRC-32 (IEEE 802.3) of a buffer.
+ *
+ * @param[in] crc CRC of the data before this buffer, or 0 for the first.
+ * @param[in] data Data to compute the CRC of.
+ * @param[in] size Size of the data in bytes.
+ *
+ * @returns The CRC of all of the data so far.
+ */
+uint32_t scron_crc32(uint32_t crc, const void *data, size_t size);
+
+/** Gets the size of every entry in the snapshots scron_serialize would write.
+ *
+ * @param[in] scron scron to query.
+ *
+ * @returns SCRON_SNAPSHOT_STATS_ENTRY_SIZE if statistics are enabled,
+ *  SCRON_SNAPSHOT_ENTRY_SIZE otherwise.
+ */
+size_t scron_serialized_entry_size(const struct scron *scron);
+
+/** Gets the size of the snapshot scron_serialize would write.
+ *
+ * @param[in] scron scron to query.
+ *
+ * @returns The size of the snapshot in bytes.
+ */
+size_t scron_serialized_size(const struct scron *scron);
+
+/** Serializes the history of every task into a snapshot.
+ *
+ * @param[in] scron scron with the history to serialize.
+ * @param[out] buffer Buffer to write the snapshot to.
+ * @param[in] size Size of the buffer in bytes.
+ *
+ * @returns The size of the snapshot in bytes, or 0 if the buffer is too
+ *  small or there are more than UINT16_MAX tasks, in which case nothing is
+ *  written.
+ */
+size_t scron_serialize(const struct scron *scron, void *buffer, size_t size);
+
+/** Gets the size of the snapshot scron_serialize_dirty would write.
+ *
+ * @param[in] scron scron to query.
+ *
+ * @returns The size of the snapshot in bytes.
+ */
+size_t scron_serialized_dirty_size(const struct scron *scron);
+
+/** Serializes the history of only the tasks whose history changed since it
+ *  was last persisted into a snapshot.
+ *
+ * Loading this snapshot only updates the tasks in it, so it is meant to be
+ * applied on top of an older snapshot with every task.
+ *
+ * @param[in] scron scron with the history to serialize.
+ * @param[out] buffer Buffer to write the snapshot to.
+ * @param[in] size Size of the buffer in bytes.
+ *
+ * @returns The size of the snapshot in bytes, or 0 if the buffer is too
+ *  small or there are more than UINT16_MAX tasks, in which case nothing is
+ *  written.
+ */
+size_t scron_serialize_dirty(const struct scron *scron, void *buffer, size_t size);
+
+/** Opens a view of a serialized snapshot, checking it in full.
+ *
+ * @param[out] snapshot View to initialize. It refers to the buffer, which
+ *  must outlive it.
+ * @param[in] buffer Buffer with the snapshot.
+ * @param[in] size Size of the buffer in bytes, which may be larger than the
+ *  snapshot.
+ *
+ * @returns True if the buffer holds a valid snapshot, false if it is corrupt,
+ *  truncated, or of an unsupported version.
+ */
+bool scron_snapshot_open(struct scron_snapshot *snapshot, const void *buffer, size_t size);
+
+/** Gets the size of a snapshot from its header, so that reading it from slow
+ *  memory can stop at its end.
+ *
+ * @param[in] header The first SCRON_SNAPSHOT_HEADER_SIZE bytes of the
+ *  snapshot.
+ *
+ * @returns The size of the whole snapshot in bytes, or 0 if the header is not
+ *  of a snapshot. Nothing else is checked, see scron_snapshot_open.
+ */
+size_t scron_snapshot_size(const void *header);
+
+/** Gets the name of a task in a snapshot.
+ *
+ * @param[in] snapshot Snapshot to query.
+ * @param[in] index Index of the task in the snapshot. Must be valid.
+ *
+ * @returns The name, pointing into the snapshot.
+ */
+const char *scron_snapshot_name(const struct scron_snapshot *snapshot, size_t index);
+
+/** Gets the history of a task in a snapshot.
+ *
+ * The cached next run time is read as it was saved, see
+ * scron_snapshot_schedule_matches.
+ *
+ * @param[in] snapshot Snapshot to query.
+ * @param[in] index Index of the task in the snapshot. Must be valid.
+ * @param[out] history History of the task.
+ */
+void scron_snapshot_history(const struct scron_snapshot *snapshot, size_t index,
+	struct scron_task_history *history);
+
+/** Checks whether a task in a snapshot was saved with the given schedule.
+ *
+ * @param[in] snapshot Snapshot to query.
+ * @param[in] index Index of the task in the snapshot. Must be valid.
+ * @param[in] sched Schedule to compare against.
+ *
+ * @returns True if the schedule has the fingerprint saved with the task,
+ *  false otherwise.
+ */
+bool scron_snapshot_schedule_matches(const struct scron_snapshot *snapshot,
+	size_t index, const struct scron_schedule *sched);
+
+/** Gets the statistics of a task in a snapshot.
+ *
+ * @param[in] snapshot Snapshot to query.
+ * @param[in] index Index of the task in the snapshot. Must be valid.
+ * @param[out] stats Statistics of the task, only written to on success.
+ *
+ * @returns True if the snapshot has statistics, false otherwise.
+ */
+bool scron_snapshot_stats(const struct scron_snapshot *snapshot, size_t index,
+	struct scron_task_stats *stats);
+
+/** Restores a task from a snapshot entry, its history, and its statistics if
+ *  both the snapshot and scron have them.
+ *
+ * The cached next run time is dropped if the schedule of the task changed
+ * since the snapshot was saved, see scron_snapshot_schedule_matches.
+ *
+ * This does not update the scron task queue or run order, see scron_refresh.
+ *
+ * @param[in] snapshot Snapshot to restore from.
+ * @param[in] entry Index of the task in the snapshot. Must be valid.
+ * @param[in,out] scron scron to restore into.
+ * @param[in] index Index of the task in scron. Must be valid.
+ */
+void scron_snapshot_restore(const struct scron_snapshot *snapshot, size_t entry,
+	struct scron *scron, size_t index);
+
+/** Loads the history of every task from a serialized snapshot.
+ *
+ * Tasks are matched by name. Tasks missing from the snapshot keep their
+ * current history, and snapshot entries for tasks that no longer exist are
+ * ignored. The scron task queue and run order are rebuilt afterwards.
+ *
+ * @param[in,out] scron scron to load the history into.
+ * @param[in] buffer Buffer with the snapshot.
+ * @param[in] size Size of the buffer in bytes.
+ *
+ * @returns True on success, false if the snapshot is not valid, in which case
+ *  scron is left untouched.
+ */
+bool scron_deserialize(struct scron *scron, const void *buffer, size_t size);
 
 #endif//SCRON_H_
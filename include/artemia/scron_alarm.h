@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#ifndef SCRON_ALARM_H_
+#define SCRON_ALARM_H_
+
+#include <scron.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/** RTC alarm repeat modes.
+ *
+ * These match the AM1815 RPT field, so they can be written to it as is. A
+ * repeating alarm fires every time the clock matches the fields of the alarm
+ * time finer than the repeat, e.g. every minute, whenever the seconds match.
+ */
+enum scron_alarm_repeat
+{
+	SCRON_ALARM_REPEAT_NONE = 0,
+	SCRON_ALARM_REPEAT_YEAR = 1,
+	SCRON_ALARM_REPEAT_MONTH = 2,
+	SCRON_ALARM_REPEAT_WEEK = 3,
+	SCRON_ALARM_REPEAT_DAY = 4,
+	SCRON_ALARM_REPEAT_HOUR = 5,
+	SCRON_ALARM_REPEAT_MINUTE = 6,
+	SCRON_ALARM_REPEAT_SECOND = 7,
+};
+
+/** Largest value of the RTC countdown timer. The AM1815 timer is 8 bits, and
+ *  counts at 1 Hz, or 1/60 Hz for longer periods.
+ */
+#define SCRON_ALARM_COUNTDOWN_MAX 255
+
+/** Number of wakes predicted when looking for a periodic pattern. */
+#define SCRON_ALARM_LOOKAHEAD 8
+
+/** Most tasks scron_alarm_is_current merges into the next wake. */
+#define SCRON_ALARM_WAKE_TASKS 16
+
+/** Size of an encoded scron_alarm_plan, in bytes. */
+#define SCRON_ALARM_PLAN_SIZE 11
+
+/** How to wake up.
+ *  - SCRON_ALARM_MATCH: the alarm fires when the clock matches the alarm time,
+ *    repeating as set by its repeat mode
+ *  - SCRON_ALARM_COUNTDOWN: the countdown timer fires at the wake, and then
+ *    every period seconds
+ */
+enum scron_alarm_mode
+{
+	SCRON_ALARM_MATCH,
+	SCRON_ALARM_COUNTDOWN,
+};
+
+/** scron alarm plan.
+ *
+ * A plan maps the next wake onto the RTC. When the wakes after it are evenly
+ * spaced, and the RTC can repeat at that spacing, the plan is periodic: the
+ * RTC keeps waking the MCU at the right times without being written to again.
+ * Otherwise, the alarm repeats at the shortest interval that still lets it
+ * fire at the wake first, so a missed rearm still wakes the MCU eventually.
+ *  - mode: how the RTC wakes the MCU
+ *  - wake: the next time to wake up
+ *  - repeat: alarm repeat mode, for SCRON_ALARM_MATCH
+ *  - period: seconds between wakes the RTC produces by itself, 0 if the plan
+ *    is not periodic
+ */
+struct scron_alarm_plan
+{
+	enum scron_alarm_mode mode;
+	time_t wake;
+	enum scron_alarm_repeat repeat;
+	uint32_t period;
+};
+
+/** scron alarm planner configuration.
+ *  - tolerance: wake coalescing tolerance, see scron_next_wake
+ *  - retry: if a task is already due when planning, e.g. because there wasn't
+ *    enough energy to run it, seconds until trying again
+ *  - countdown: whether the RTC has a countdown timer the plan can use
+ */
+struct scron_alarm_config
+{
+	time_t tolerance;
+	time_t retry;
+	bool countdown;
+};
+
+/** RTC interface used to arm plans.
+ *  - write_alarm: sets the alarm time and repeat mode, and enables the alarm
+ *    interrupt, or disables the alarm if repeat is SCRON_ALARM_REPEAT_NONE.
+ *    Returns true on success
+ *  - write_countdown: starts the countdown timer, firing first seconds from
+ *    now, and then every period seconds, or stops it if period is 0. Returns
+ *    true on success. NULL if the RTC has no countdown timer
+ *  - data: passed to write_alarm and write_countdown
+ *
+ * The interface only deals in plans, so a mock RTC can stand in for the real
+ * one on the host.
+ */
+struct scron_rtc
+{
+	bool (*write_alarm)(void *data, time_t time, enum scron_alarm_repeat repeat);
+	bool (*write_countdown)(void *data, uint32_t first, uint32_t period);
+	void *data;
+};
+
+/** Gets the interval of a repeat mode, in seconds.
+ *
+ * @param[in] repeat Repeat mode to query.
+ *
+ * @returns The number of seconds between alarms, or 0 for
+ *  SCRON_ALARM_REPEAT_NONE and repeat modes without a fixed interval (months
+ *  and years).
+ */
+uint32_t scron_alarm_repeat_interval(enum scron_alarm_repeat repeat);
+
+/** Plans the next wake.
+ *
+ * This predicts the next SCRON_ALARM_LOOKAHEAD wakes, coalesced as by
+ * scron_next_wake, assuming every task runs at the wake it is due. If they
+ * are evenly spaced one repeat interval or a countdown period apart, the plan
+ * is periodic. Predicting is O(n log n) in the number of tasks, and
+ * allocates, so it is meant to run at most once before going to sleep, and
+ * not at all when scron_alarm_is_current.
+ *
+ * @param[in] scron scron to plan for.
+ * @param[in] config Planner configuration.
+ * @param[in] now The current time.
+ * @param[out] plan The plan. Only written to on success.
+ *
+ * @returns True on success, false if no task will ever run again, or memory
+ *  could not be allocated.
+ */
+bool scron_alarm_plan(const struct scron *scron,
+	const struct scron_alarm_config *config, time_t now,
+	struct scron_alarm_plan *plan);
+
+/** Checks whether the RTC already fires next at the next wake, so there is
+ *  no need to plan or arm it again.
+ *
+ * This is the case when the armed plan is periodic, and fires next after now
+ * at the wake scron_next_wake works out. It is O(k log k) in the number of
+ * tasks due within the window of the next one, and does not allocate.
+ *
+ * @param[in] scron scron to check.
+ * @param[in] config Planner configuration.
+ * @param[in] armed The plan the RTC is armed with.
+ * @param[in] now The current time.
+ *
+ * @returns True if the RTC is armed for the next wake, false if it needs
+ *  planning.
+ */
+bool scron_alarm_is_current(const struct scron *scron,
+	const struct scron_alarm_config *config,
+	const struct scron_alarm_plan *armed, time_t now);
+
+/** Encodes a plan into SCRON_ALARM_PLAN_SIZE bytes, to persist what the RTC
+ *  is armed with across MCU resets, e.g. in RTC RAM.
+ *
+ * The wake is stored as a 32 bit time, and the encoding has a checksum.
+ *
+ * @param[in] plan Plan to encode.
+ * @param[out] buffer Buffer of at least SCRON_ALARM_PLAN_SIZE bytes.
+ */
+void scron_alarm_plan_encode(const struct scron_alarm_plan *plan, void *buffer);
+
+/** Decodes a plan encoded by scron_alarm_plan_encode.
+ *
+ * @param[out] plan The plan. Only written to on success.
+ * @param[in] buffer Buffer of at least SCRON_ALARM_PLAN_SIZE bytes.
+ *
+ * @returns True on success, false if the buffer does not hold a plan, in
+ *  which case what the RTC is armed with is unknown.
+ */
+bool scron_alarm_plan_decode(struct scron_alarm_plan *plan, const void *buffer);
+
+/** Arms a plan on the RTC.
+ *
+ * If the armed plan is periodic, and already fires next at the wake of the
+ * new plan, the RTC is left as it is.
+ *
+ * @param[in] rtc RTC to arm.
+ * @param[in] plan Plan to arm.
+ * @param[in,out] armed The plan the RTC is armed with, updated on success.
+ *  Zero initialize it when what the RTC is armed with is unknown. The MCU
+ *  forgets it on every reset, so persist it, see scron_alarm_plan_encode.
+ * @param[in] now The current time.
+ *
+ * @returns True on success, including when nothing had to be written, false
+ *  if writing to the RTC failed.
+ */
+bool scron_alarm_arm(const struct scron_rtc *rtc,
+	const struct scron_alarm_plan *plan, struct scron_alarm_plan *armed,
+	time_t now);
+
+#endif//SCRON_ALARM_H_
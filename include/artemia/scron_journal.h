@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#ifndef SCRON_JOURNAL_H_
+#define SCRON_JOURNAL_H_
+
+#include <scron.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** scron history journal.
+ *
+ * The journal is a single append-only file. Every save appends one record.
+ * Full records hold the history of every task, while delta records only hold
+ * the history that changed since the last save. Loading walks back from the
+ * end of the file through the deltas until the newest full record, so it only
+ * needs to read the tail of the file. Records are laid out as:
+ *
+ *  - header: magic, SCRON_JOURNAL_MAGIC for full records and
+ *    SCRON_JOURNAL_DELTA_MAGIC for deltas, and payload size (uint32_t each)
+ *  - payload: a snapshot, as written by scron_serialize
+ *  - footer: payload size, CRC-32 of the header and payload, magic (uint32_t
+ *    each)
+ *
+ * All integers are little endian. The footer lets a loader find the start of
+ * the last record from the end of the file. If the last record is torn or
+ * corrupt, e.g. because power was lost while writing it, the loader walks
+ * back to the record before it.
+ *
+ * Once the journal grows past compact_size bytes, it is rewritten with only a
+ * full record of the current history. The rewrite goes to a temporary file
+ * first, which is then renamed over the journal.
+ *  - path: path to the journal file
+ *  - temporary_path: path used while compacting
+ *  - compact_size: size in bytes past which the journal is compacted
+ */
+struct scron_journal
+{
+	const char *path;
+	const char *temporary_path;
+	size_t compact_size;
+};
+
+/** Magic number marking journal record footers, and the headers of full
+ *  records, "SCRJ".
+ */
+#define SCRON_JOURNAL_MAGIC UINT32_C(0x4A524353)
+
+/** Magic number marking the headers of delta journal records, "SCRD". */
+#define SCRON_JOURNAL_DELTA_MAGIC UINT32_C(0x44524353)
+
+/** Appends the history to the journal, compacting it if it grew past its
+ *  compaction size.
+ *
+ * Unless a full record is asked for, or tasks were added or removed, only the
+ * history that is dirty is appended, and nothing is written if nothing is
+ * dirty. This does not clear the dirty history.
+ *
+ * @param[in] journal Journal to append to.
+ * @param[in] scron scron with the history to save.
+ * @param[in] full Whether to save the history of every task.
+ *
+ * @returns True on success, false if the record could not be written. A
+ *  failed compaction leaves the journal as it was, and is not an error.
+ */
+bool scron_journal_save(const struct scron_journal *journal, const struct scron *scron,
+	bool full);
+
+/** Loads the history of every task from the newest valid journal records.
+ *
+ * Every task gets the history from the newest record that has it, looking
+ * back no further than the newest full record. Tasks missing from the
+ * records keep their current history, and history for tasks that no longer
+ * exist is ignored. The scron task queue and run order
+ * are rebuilt afterwards.
+ *
+ * If only the temporary file exists, because power was lost in the middle of
+ * a compaction, it is first renamed over the journal to finish the
+ * compaction.
+ *
+ * @param[in] journal Journal to load from.
+ * @param[in,out] scron scron to load the history into.
+ *
+ * @returns True if a valid record was found and loaded, false otherwise.
+ */
+bool scron_journal_load(const struct scron_journal *journal, struct scron *scron);
+
+#endif//SCRON_JOURNAL_H_
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#ifndef SCRON_STORAGE_H_
+#define SCRON_STORAGE_H_
+
+#include <scron.h>
+#include <scron_journal.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** scron storage backend.
+ *
+ * Backends save and load the history of every task somewhere. The built-in
+ * backends are the journal (a file, e.g. in littlefs), a buffer in memory,
+ * and RTC RAM with a fallback to another backend.
+ *  - save: saves the history of scron, returning true on success. Unless full
+ *    is true, the backend may save only the dirty history.
+ *  - load: loads the history into scron, rebuilding its task queue and run
+ *    order, returning true on success
+ *  - data: backend state, passed to save and load
+ */
+struct scron_storage
+{
+	bool (*save)(void *data, const struct scron *scron, bool full);
+	bool (*load)(void *data, struct scron *scron);
+	void *data;
+};
+
+/** Saves the history that changed since it was last persisted to a storage
+ *  backend.
+ *
+ * The dirty history is cleared on success.
+ *
+ * @param[in] storage Storage backend to save to.
+ * @param[in,out] scron scron with the history to save.
+ *
+ * @returns True on success, false otherwise.
+ */
+bool scron_storage_save(const struct scron_storage *storage, struct scron *scron);
+
+/** Loads the history of every task from a storage backend.
+ *
+ * The dirty history is cleared on success, as it matches what's persisted.
+ *
+ * @param[in] storage Storage backend to load from.
+ * @param[in,out] scron scron to load the history into.
+ *
+ * @returns True on success, false if nothing valid was found.
+ */
+bool scron_storage_load(const struct scron_storage *storage, struct scron *scron);
+
+/** Initializes a storage backend that uses a journal.
+ *
+ * @param[out] storage Storage backend to initialize.
+ * @param[in] journal Journal to use, which must outlive the backend.
+ */
+void scron_storage_init_journal(struct scron_storage *storage,
+	const struct scron_journal *journal);
+
+/** In-memory storage, mostly useful for testing on the host.
+ *  - buffer: buffer the snapshot is saved to
+ *  - capacity: size of the buffer in bytes
+ *  - size: size of the saved snapshot in bytes, 0 if nothing is saved
+ */
+struct scron_memory_storage
+{
+	uint8_t *buffer;
+	size_t capacity;
+	size_t size;
+};
+
+/** Initializes a storage backend that saves to memory.
+ *
+ * @param[out] storage Storage backend to initialize.
+ * @param[in,out] memory In-memory storage to use, which must outlive the
+ *  backend. Its buffer and capacity must be set.
+ */
+void scron_storage_init_memory(struct scron_storage *storage,
+	struct scron_memory_storage *memory);
+
+/** Size of the save counter before the snapshot in RTC RAM, in bytes. */
+#define SCRON_RTC_RAM_HEADER_SIZE 4
+
+/** RTC RAM storage.
+ *
+ * Battery-backed RAM, like the one in the AM1815 RTC, is much cheaper to
+ * write than flash. The snapshot is written to it after a 4 byte save
+ * counter, and its CRC tells whether the RAM survived. When the RAM already
+ * holds a snapshot with the same tasks, only the header and the dirty entries
+ * are rewritten.
+ *
+ * If the snapshot doesn't fit in the RAM, writing the RAM fails, or the RAM
+ * doesn't hold a valid snapshot when loading, the fallback backend is used
+ * instead. A save that can't go to the RAM also invalidates the snapshot in
+ * it, so loading never picks it over the newer history in the fallback. The
+ * fallback is also written every fallback_interval saves, so it is never too
+ * far behind if the RTC loses power. It only gets the dirty history if it
+ * already had everything else, e.g. while the snapshot doesn't fit in the
+ * RAM, and everything otherwise.
+ *
+ * Loading reads the header first, and then only as much of the RAM as the
+ * snapshot takes up.
+ *  - read: reads size bytes from the RAM at address into buffer, returning
+ *    true on success
+ *  - write: writes size bytes from buffer to the RAM at address, returning
+ *    true on success
+ *  - data: passed to read and write
+ *  - size: size of the RAM in bytes
+ *  - fallback: backend to use when the RAM can't be, may be NULL
+ *  - fallback_interval: how many saves go by between writes to the fallback,
+ *    0 to only use it when the RAM can't be used
+ *  - count: number of saves so far, updated on every save and load
+ *  - synced_size: size of the contents of the RAM if they have the same tasks
+ *    as the scron history, 0 otherwise, updated on every save and load
+ *  - fallback_synced: whether the fallback has all of the history as of the
+ *    last save or load, updated on every save and load
+ *  - too_large: whether the last save didn't fit in the RAM, updated on every
+ *    save
+ */
+struct scron_rtc_ram_storage
+{
+	bool (*read)(void *data, size_t address, void *buffer, size_t size);
+	bool (*write)(void *data, size_t address, const void *buffer, size_t size);
+	void *data;
+	size_t size;
+	const struct scron_storage *fallback;
+	uint32_t fallback_interval;
+	uint32_t count;
+	size_t synced_size;
+	bool fallback_synced;
+	bool too_large;
+};
+
+/** Initializes a storage backend that saves to RTC RAM.
+ *
+ * @param[out] storage Storage backend to initialize.
+ * @param[in,out] rtc_ram RTC RAM storage to use, which must outlive the
+ *  backend.
+ */
+void scron_storage_init_rtc_ram(struct scron_storage *storage,
+	struct scron_rtc_ram_storage *rtc_ram);
+
+#endif//SCRON_STORAGE_H_
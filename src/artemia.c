@@ -2,64 +2,318 @@
 // SPDX-FileCopyrightText: Gabriel Marcano, 2023
 
 #include <artemia.h>
+#include <artemia_log.h>
+#include <artemia_trace.h>
 #include <scron.h>
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
-#include <stdlib.h>
 
-// FIXME HACK testing printf
-#include <stdio.h>
+// Deadline of a task, the end of its delta window, or SCRON_NEVER if it has
+// none
+static time_t artemia_deadline(const struct scron *scron, size_t index)
+{
+	const struct scron_task *task = scron_get_task(scron, index);
+	if (task->delta <= 0)
+		return SCRON_NEVER;
+	return scron_get_next_run(scron, index) + task->delta;
+}
+
+// Adds a task to the batch, keeping the batch sorted by the policy. Tasks
+// come in least recently run order, so LRU only appends, and EDF inserts by
+// deadline, with ties staying least recently run first. If the batch is full,
+// the task that sorts last is dropped
+static void artemia_batch_insert(const struct scron *scron,
+	enum artemia_policy policy, size_t *batch, size_t *batch_size,
+	size_t max_tasks, size_t index)
+{
+	size_t pos = *batch_size;
+	if (policy == ARTEMIA_POLICY_EDF)
+	{
+		time_t deadline = artemia_deadline(scron, index);
+		while (pos > 0 && artemia_deadline(scron, batch[pos - 1]) > deadline)
+			--pos;
+	}
+	if (pos >= max_tasks)
+		return;
+
+	size_t end = *batch_size < max_tasks ? *batch_size : max_tasks - 1;
+	for (size_t i = end; i > pos; --i)
+		batch[i] = batch[i - 1];
+	batch[pos] = index;
+	if (*batch_size < max_tasks)
+		*batch_size += 1;
+}
+
+static void artemia_run_task(struct scron *scron,
+	const struct artemia_config *config, size_t index, uint32_t voltage, time_t now)
+{
+	const struct scron_task *task = scron_get_task(scron, index);
+	time_t next_run = scron_get_next_run(scron, index);
+	ARTEMIA_LOG_INFO("running: %s, last: %lld, next: %lld, now: %lld, diff: %lld",
+		task->name, (long long)scron->history[index].last_run,
+		(long long)next_run, (long long)now, (long long)(now - next_run));
+	artemia_trace_record(config->trace, ARTEMIA_TRACE_TASK_BEGIN, index);
+	uint32_t start = config->read_clock ? config->read_clock(config->clock_data) : 0;
+	task->function(&now);
+	uint32_t end = config->read_clock ? config->read_clock(config->clock_data) : 0;
+	artemia_trace_record(config->trace, ARTEMIA_TRACE_TASK_END, index);
+	scron_record_run(scron, index, now - next_run, end - start, voltage);
+	// After the task, update history and the run order
+	scron_set_last_run(scron, index, now);
+}
+
+// Converts a voltage to millivolts, rounding down, so a task never runs below
+// its minimum
+static uint32_t artemia_millivolts(double voltage)
+{
+	if (!(voltage > 0.0))
+		return 0;
+	if (voltage >= UINT32_MAX / 1000.0)
+		return UINT32_MAX;
+	return (uint32_t)(voltage * 1000.0);
+}
+
+// Re-reads the storage voltage, in millivolts
+static uint32_t artemia_read_voltage(const struct artemia_config *config)
+{
+	if (config->read_millivolts)
+		return config->read_millivolts(config->voltage_data);
+	return artemia_millivolts(config->read_voltage(config->voltage_data));
+}
 
-struct sort_task
+// Energy stored in the capacitor at the given voltage, in microjoules. uF
+// times mV squared is in 1e-12 J, so halving it and dividing by 1e6 leaves
+// microjoules
+static uint64_t artemia_stored_energy(const struct artemia_capacitor *capacitor,
+	uint32_t voltage)
 {
-	struct scron_task *task;
-	time_t *last_run;
-};
+	return (uint64_t)capacitor->capacitance * voltage * voltage / 2000000;
+}
 
-static int qsort_tasks(const void * a, const void *b)
+// Energy stored in the capacitor above its floor voltage, in microjoules
+static uint32_t artemia_available_energy(const struct artemia_capacitor *capacitor,
+	uint32_t voltage)
 {
-	const struct sort_task *a_ = a;
-	const struct sort_task *b_ = b;
-	if (*a_->last_run < *b_->last_run)
-		return -1;
-	if (*a_->last_run > *b_->last_run)
-		return 1;
-	return 0;
+	if (voltage <= capacitor->floor_voltage)
+		return 0;
+	uint64_t available = artemia_stored_energy(capacitor, voltage) -
+		artemia_stored_energy(capacitor, capacitor->floor_voltage);
+	return available < UINT32_MAX ? available : UINT32_MAX;
+}
+
+// Chooses the subset of the batch that fits in the available energy with a
+// 0/1 knapsack over the energy split into buckets. Every task is worth more
+// than all of the policy order bonuses put together, so the most tasks win
+// first, and ties go to the tasks earliest in the batch. The batch is
+// compacted in place to the chosen tasks, and the new size is returned
+static size_t artemia_select_batch(const struct scron *scron,
+	enum artemia_policy policy, uint32_t available, size_t *batch, size_t batch_size)
+{
+	uint32_t value[ARTEMIA_ENERGY_BUCKETS + 1] = {0};
+	uint64_t keep[ARTEMIA_MAX_BATCH] = {0};
+	unsigned weight[ARTEMIA_MAX_BATCH];
+
+	for (size_t i = 0; i < batch_size; ++i)
+	{
+		uint32_t cost = scron->history[batch[i]].energy;
+		if (cost > available)
+		{
+			weight[i] = ARTEMIA_ENERGY_BUCKETS + 1;
+			continue;
+		}
+		// Round up, so the chosen tasks never add up to more than is
+		// available. Nothing being available, only free tasks get here
+		unsigned buckets = available ? (unsigned)(((uint64_t)cost *
+			ARTEMIA_ENERGY_BUCKETS + available - 1) / available) : 0;
+		weight[i] = buckets;
+
+		uint32_t worth = ARTEMIA_MAX_BATCH * ARTEMIA_MAX_BATCH + (batch_size - i);
+		for (unsigned w = ARTEMIA_ENERGY_BUCKETS + 1; w-- > buckets;)
+		{
+			if (value[w - buckets] + worth > value[w])
+			{
+				value[w] = value[w - buckets] + worth;
+				keep[i] |= UINT64_C(1) << w;
+			}
+		}
+	}
+
+	// Walk back through the choices to find which tasks were kept
+	bool chosen[ARTEMIA_MAX_BATCH] = {0};
+	unsigned w = ARTEMIA_ENERGY_BUCKETS;
+	for (size_t i = batch_size; i-- > 0;)
+	{
+		if (keep[i] & (UINT64_C(1) << w))
+		{
+			chosen[i] = true;
+			w -= weight[i];
+		}
+	}
+
+	size_t size = 0;
+	for (size_t i = 0; i < batch_size; ++i)
+	{
+		if (chosen[i])
+			batch[size++] = batch[i];
+	}
+
+	// EDF keeps deadline order, else run the tasks needing the most voltage
+	// while the storage is fullest (stable insertion sort)
+	for (size_t i = 1; policy != ARTEMIA_POLICY_EDF && i < size; ++i)
+	{
+		size_t index = batch[i];
+		uint16_t minimum = scron_get_task(scron, index)->minimum_millivolts;
+		size_t j = i;
+		for (; j > 0 && scron_get_task(scron, batch[j - 1])->minimum_millivolts < minimum; --j)
+			batch[j] = batch[j - 1];
+		batch[j] = index;
+	}
+	return size;
 }
 
 bool artemia_scheduler(struct scron *scron, double voltage, time_t now)
 {
+	return artemia_scheduler_millivolts(scron, artemia_millivolts(voltage), now);
+}
+
+bool artemia_scheduler_millivolts(struct scron *scron, uint32_t voltage, time_t now)
+{
+	const struct artemia_config config = {
+		.max_tasks = 1,
+	};
+	return artemia_scheduler_batch_millivolts(scron, &config, voltage, now, NULL) != 0;
+}
+
+size_t artemia_scheduler_batch(struct scron *scron,
+	const struct artemia_config *config, double voltage, time_t now,
+	struct artemia_stats *stats)
+{
+	return artemia_scheduler_batch_millivolts(scron, config,
+		artemia_millivolts(voltage), now, stats);
+}
+
+size_t artemia_scheduler_batch_millivolts(struct scron *scron,
+	const struct artemia_config *config, uint32_t voltage, time_t now,
+	struct artemia_stats *stats)
+{
+	struct artemia_stats unused;
+	if (!stats)
+		stats = &unused;
+	stats->ran = 0;
+	stats->missed = 0;
+
+	artemia_trace_record(config->trace, ARTEMIA_TRACE_SCHEDULER_BEGIN, 0);
 	const size_t task_count = scron_get_task_count(scron);
-	// Iterate through all tasks...
-	struct sort_task *order = malloc(task_count * sizeof(*order));
-	for (size_t i = 0; i < task_count; ++i)
+	// If the earliest task in the queue isn't due yet, no task is
+	if (!task_count || scron_next_time(scron) > now)
 	{
-		order[i].task = scron_get_task(scron, i);
-		order[i].last_run = &scron->history[i].last_run;
+		artemia_trace_record(config->trace, ARTEMIA_TRACE_SCHEDULER_END, 0);
+		return 0;
 	}
-	qsort(order, task_count, sizeof(*order), qsort_tasks);
 
-	for (size_t i = 0; i < task_count; ++i)
+	size_t max_tasks = config->max_tasks;
+	if (!max_tasks || max_tasks > ARTEMIA_MAX_BATCH)
+		max_tasks = ARTEMIA_MAX_BATCH;
+
+	// Work out every task that can run from the snapshot, in policy order,
+	// before running any of them, as running a task changes the run order.
+	// Tasks whose window passed are counted and moved to their next time.
+	// LRU stops at the first tasks that can run, so it classifies tasks as it
+	// goes, and skips the ones that aren't due by their next run time alone,
+	// without touching the rest of their hot fields. Scanning every task
+	// first is several times slower for it at thousands of tasks, as the walk
+	// rarely goes far. Otherwise, every task is classified in one pass first,
+	// so the walk in run order stops once it has seen every task that isn't
+	// waiting
+	const bool lru = config->policy == ARTEMIA_POLICY_LRU;
+	size_t pending = lru ? task_count : scron_scan(scron, now, voltage);
+	size_t batch[ARTEMIA_MAX_BATCH];
+	size_t batch_size = 0;
+	for (size_t i = 0; pending && i < task_count; ++i)
 	{
-		struct scron_task *task = order[i].task;
-		// Only select a task if we're at a voltage higher than the minimum...
-		if (task->minimum_voltage <= voltage)
+		size_t index = scron_get_run_order(scron, i);
+		if (lru && scron_get_next_run(scron, index) > now)
+			continue;
+		enum scron_scan_state state = lru ?
+			scron_scan_task(scron, index, now, voltage) :
+			scron_get_scan_state(scron, index);
+		if (state == SCRON_SCAN_WAITING)
+			continue;
+		pending -= 1;
+		switch (state)
 		{
-			time_t last_run = *order[i].last_run;
-			time_t next_run = scron_schedule_next_time(&task->schedule, last_run);
-			double diff = difftime(now, next_run);
-			// And if we're past the scheduled time, and if delta is set, that
-			// we're within that delta from the schedule
-			if (diff >= 0.0 && (task->delta <= 0 || task->delta > diff))
-			{
-				printf("running: %s, last: %lu, next: %lu, now: %lu, diff: %lu\r\n", task->name, (uint32_t)last_run, (uint32_t)next_run, (uint32_t)now, (uint32_t)diff);
-				task->function(&now);
-				// After the task, update history
-				*order[i].last_run = now;
-				return true;
-			}
+		case SCRON_SCAN_WAITING:
+			break;
+		case SCRON_SCAN_MISSED:
+			stats->missed += 1;
+			artemia_trace_record(config->trace, ARTEMIA_TRACE_TASK_MISSED, index);
+			scron_record_miss(scron, index);
+			scron_reschedule(scron, index, now);
+			break;
+		case SCRON_SCAN_DUE:
+			artemia_batch_insert(scron, config->policy, batch, &batch_size, max_tasks, index);
+			break;
+		case SCRON_SCAN_LOW_VOLTAGE:
+			// Only select a task if we're at a voltage higher than the minimum
+			artemia_trace_record(config->trace, ARTEMIA_TRACE_TASK_SKIPPED, index);
+			scron_record_voltage_skip(scron, index);
+			break;
+		}
+		// LRU never displaces a task from a full batch, so stop early
+		if (lru && batch_size == max_tasks)
+			break;
+	}
+
+	const struct artemia_capacitor *capacitor = &config->capacitor;
+	const bool model = capacitor->capacitance > 0;
+	if (model)
+	{
+		uint32_t available = artemia_available_energy(capacitor, voltage);
+		batch_size = artemia_select_batch(scron, config->policy, available, batch, batch_size);
+	}
+	for (size_t i = 0; i < batch_size; ++i)
+		artemia_trace_record(config->trace, ARTEMIA_TRACE_TASK_SELECTED, batch[i]);
+
+	size_t ran = 0;
+	bool fresh = true;
+	const bool can_read = config->read_millivolts || config->read_voltage;
+	for (size_t i = 0; i < batch_size; ++i)
+	{
+		// The first task uses the snapshot, the rest a fresh reading, as the
+		// tasks before them drained the storage
+		if (!fresh && can_read)
+			voltage = artemia_read_voltage(config);
+		fresh = false;
+		const struct scron_task *task = scron_get_task(scron, batch[i]);
+		if (task->minimum_millivolts > voltage)
+		{
+			artemia_trace_record(config->trace, ARTEMIA_TRACE_TASK_SKIPPED, batch[i]);
+			scron_record_voltage_skip(scron, batch[i]);
+			continue;
+		}
+		if (config->prepare_task && !config->prepare_task(config->prepare_data, task))
+		{
+			artemia_trace_record(config->trace, ARTEMIA_TRACE_TASK_SKIPPED, batch[i]);
+			continue;
+		}
+		artemia_run_task(scron, config, batch[i], voltage, now);
+		++ran;
+		stats->ran = ran;
+
+		// Learn how much energy the task took from the storage
+		if (model && can_read)
+		{
+			uint64_t before = artemia_stored_energy(capacitor, voltage);
+			voltage = artemia_read_voltage(config);
+			fresh = true;
+			uint64_t after = artemia_stored_energy(capacitor, voltage);
+			uint64_t used = before > after ? before - after : 0;
+			scron_record_energy(scron, batch[i], used < UINT32_MAX ? (uint32_t)used : UINT32_MAX);
 		}
 	}
-	return false;
+	artemia_trace_record(config->trace, ARTEMIA_TRACE_SCHEDULER_END, ran);
+	return ran;
 }
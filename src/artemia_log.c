@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <artemia_log.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "little_endian.h"
+
+// Largest record, limited by its size byte
+#define LOG_RECORD_MAX 256
+
+// Start of the format strings. The linker script defines it on the device,
+// and GNU ld on the host, as long as anything logs at all
+extern const char __start_artemia_log[] __attribute__((weak));
+
+static struct
+{
+	uint8_t *buffer;
+	size_t capacity;
+	size_t size;
+	uint32_t dropped;
+} artemia_log;
+
+static size_t put_varint(uint8_t *buffer, uint64_t value)
+{
+	size_t size = 0;
+	do
+	{
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		buffer[size++] = byte | (value ? 0x80 : 0);
+	} while (value);
+	return size;
+}
+
+void artemia_log_init(uint8_t *buffer, size_t capacity)
+{
+	artemia_log.buffer = buffer;
+	artemia_log.capacity = buffer ? capacity : 0;
+	if (artemia_log.capacity > UINT16_MAX)
+		artemia_log.capacity = UINT16_MAX;
+	artemia_log.size = 0;
+	artemia_log.dropped = 0;
+}
+
+void artemia_log_record(const char *format,
+	const struct artemia_log_argument *arguments, size_t count)
+{
+	if (!artemia_log.capacity)
+		return;
+
+	// Encode into a scratch record first, as the size goes before it
+	uint8_t record[LOG_RECORD_MAX];
+	size_t size = 1;
+	size += put_varint(record + size, (uintptr_t)format - (uintptr_t)__start_artemia_log);
+	for (size_t i = 0; i < count && i < ARTEMIA_LOG_MAX_ARGUMENTS; ++i)
+	{
+		const struct artemia_log_argument *argument = &arguments[i];
+		switch (argument->type)
+		{
+		case ARTEMIA_LOG_INTEGER:
+		{
+			// Zigzag, so small negative numbers stay small
+			uint64_t value = (uint64_t)argument->integer;
+			value = (value << 1) ^ (argument->integer < 0 ? UINT64_MAX : 0);
+			size += put_varint(record + size, value);
+			break;
+		}
+		case ARTEMIA_LOG_REAL:
+		{
+			float real = argument->real;
+			uint32_t bits;
+			memcpy(&bits, &real, sizeof(bits));
+			put_u32(record + size, bits);
+			size += 4;
+			break;
+		}
+		case ARTEMIA_LOG_STRING:
+		{
+			// Strings are cut short to whatever room the record has left,
+			// leaving enough for the rest of the arguments
+			const char *string = argument->string ? argument->string : "(null)";
+			size_t room = LOG_RECORD_MAX - size - 1 -
+				(ARTEMIA_LOG_MAX_ARGUMENTS - i - 1) * 10;
+			size_t length = strlen(string);
+			if (length > room)
+				length = room;
+			if (length > UINT8_MAX)
+				length = UINT8_MAX;
+			record[size++] = length;
+			memcpy(record + size, string, length);
+			size += length;
+			break;
+		}
+		}
+	}
+	record[0] = size - 1;
+
+	if (artemia_log.size + size > artemia_log.capacity)
+	{
+		if (artemia_log.dropped < UINT32_MAX)
+			artemia_log.dropped += 1;
+		return;
+	}
+	memcpy(artemia_log.buffer + artemia_log.size, record, size);
+	artemia_log.size += size;
+}
+
+bool artemia_log_flush(artemia_log_write_callback write, void *data)
+{
+	if (!artemia_log.size && !artemia_log.dropped)
+		return true;
+
+	uint8_t header[ARTEMIA_LOG_HEADER_SIZE] = {0};
+	put_u32(header, ARTEMIA_LOG_MAGIC);
+	header[4] = ARTEMIA_LOG_VERSION;
+	put_u16(header + 6, artemia_log.size);
+	put_u32(header + 8, artemia_log.dropped);
+	if (!write(data, header, sizeof(header)))
+		return false;
+	if (artemia_log.size && !write(data, artemia_log.buffer, artemia_log.size))
+		return false;
+
+	artemia_log.size = 0;
+	artemia_log.dropped = 0;
+	return true;
+}
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <artemia_trace.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "little_endian.h"
+
+// Events are written out in chunks of this many, to keep writes few and large
+#define TRACE_DUMP_CHUNK 16
+
+void artemia_trace_init(struct artemia_trace *trace,
+	struct artemia_trace_event *events, size_t capacity,
+	artemia_clock_callback read_clock, void *clock_data, uint32_t clock_hz)
+{
+	trace->events = events;
+	trace->capacity = capacity;
+	trace->head = 0;
+	trace->count = 0;
+	trace->lost = 0;
+	trace->read_clock = read_clock;
+	trace->clock_data = clock_data;
+	trace->clock_hz = clock_hz;
+}
+
+void artemia_trace_record(struct artemia_trace *trace,
+	enum artemia_trace_type type, uint16_t argument)
+{
+	if (!trace || !trace->capacity)
+		return;
+	struct artemia_trace_event *event = &trace->events[trace->head];
+	event->timestamp = trace->read_clock(trace->clock_data);
+	event->type = type;
+	event->argument = argument;
+
+	if (++trace->head == trace->capacity)
+		trace->head = 0;
+	if (trace->count < trace->capacity)
+		trace->count += 1;
+	else if (trace->lost < UINT32_MAX)
+		trace->lost += 1;
+}
+
+bool artemia_trace_dump(struct artemia_trace *trace, time_t time,
+	artemia_trace_write_callback write, void *data)
+{
+	uint8_t header[ARTEMIA_TRACE_HEADER_SIZE] = {0};
+	put_u32(header, ARTEMIA_TRACE_MAGIC);
+	header[4] = ARTEMIA_TRACE_VERSION;
+	header[5] = ARTEMIA_TRACE_EVENT_SIZE;
+	put_u32(header + 8, trace->clock_hz);
+	put_u64(header + 12, (uint64_t)time);
+	put_u32(header + 20, trace->count);
+	put_u32(header + 24, trace->lost);
+	if (!write(data, header, sizeof(header)))
+		return false;
+
+	// The oldest event is at the head once the buffer has wrapped
+	size_t index = trace->count < trace->capacity ? 0 : trace->head;
+	uint8_t chunk[TRACE_DUMP_CHUNK * ARTEMIA_TRACE_EVENT_SIZE];
+	size_t size = 0;
+	for (size_t i = 0; i < trace->count; ++i)
+	{
+		const struct artemia_trace_event *event = &trace->events[index];
+		uint8_t *buffer = chunk + size;
+		put_u32(buffer, event->timestamp);
+		buffer[4] = event->type;
+		buffer[5] = 0;
+		put_u16(buffer + 6, event->argument);
+		size += ARTEMIA_TRACE_EVENT_SIZE;
+		if (size == sizeof(chunk) || i + 1 == trace->count)
+		{
+			if (!write(data, chunk, size))
+				return false;
+			size = 0;
+		}
+		if (++index == trace->capacity)
+			index = 0;
+	}
+
+	trace->head = 0;
+	trace->count = 0;
+	trace->lost = 0;
+	return true;
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#ifndef LITTLE_ENDIAN_H_
+#define LITTLE_ENDIAN_H_
+
+// Little endian integer encoding, shared by everything that writes out a
+// binary format: snapshots, journals, the RTC RAM, traces and logs. Internal
+// to the library, not installed
+
+#include <stddef.h>
+#include <stdint.h>
+
+static inline void put_u16(uint8_t *buffer, uint16_t value)
+{
+	buffer[0] = value & 0xFF;
+	buffer[1] = (value >> 8) & 0xFF;
+}
+
+static inline uint16_t get_u16(const uint8_t *buffer)
+{
+	return buffer[0] | (buffer[1] << 8);
+}
+
+static inline void put_u32(uint8_t *buffer, uint32_t value)
+{
+	for (size_t i = 0; i < 4; ++i)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static inline uint32_t get_u32(const uint8_t *buffer)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < 4; ++i)
+		value |= (uint32_t)buffer[i] << (8 * i);
+	return value;
+}
+
+static inline void put_u64(uint8_t *buffer, uint64_t value)
+{
+	put_u32(buffer, value);
+	put_u32(buffer + 4, value >> 32);
+}
+
+static inline uint64_t get_u64(const uint8_t *buffer)
+{
+	return get_u32(buffer) | ((uint64_t)get_u32(buffer + 4) << 32);
+}
+
+#endif//LITTLE_ENDIAN_H_
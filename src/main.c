@@ -1,9 +1,16 @@
 // SPDX-License-Identifier: Apache-2.0
 // SPDX-FileCopyrightText: Gabriel Marcano, 2023
 
+#include "tasks.h"
+
 #include <scron.h>
+#include <scron_journal.h>
+#include <scron_alarm.h>
+#include <scron_storage.h>
 #include <power_control.h>
 #include <artemia.h>
+#include <artemia_log.h>
+#include <artemia_trace.h>
 
 #include <adc.h>
 #include <spi.h>
@@ -54,6 +61,18 @@ static struct pdm *pdm;
 static struct fft fft;
 static struct lora lora;
 
+// Tokenized logs of this wake, flushed to the UART before shutting down
+static uint8_t log_buffer[1024];
+
+#ifdef ARTEMIA_TRACE
+// Room for a few hundred events per wake, in 4 KiB of RAM
+static struct artemia_trace_event trace_events[512];
+static struct artemia_trace trace_buffer;
+static struct artemia_trace *trace = &trace_buffer;
+#else
+static struct artemia_trace *trace;
+#endif
+
 static const uint8_t PHOTORES_PIN = 16;
 static const uint8_t VADP_PIN = 29;
 static const uint8_t VRTC_PIN = 11;
@@ -81,7 +100,7 @@ void write_csv_line(FILE * fp, uint32_t data) {
 	fprintf(fp, "%s,%lu\r\n", buffer, data);
 }
 
-static int task_get_temperature_data(void* data)
+int task_get_temperature_data(void* data)
 {
 	(void)data;
 	// Open the file and check the header
@@ -107,7 +126,7 @@ static int task_get_temperature_data(void* data)
 	return 0;
 }
 
-static int task_get_pressure_data(void* data)
+int task_get_pressure_data(void* data)
 {
 	(void)data;
 	// Open the file and check the header
@@ -133,7 +152,7 @@ static int task_get_pressure_data(void* data)
 	return 0;
 }
 
-static int task_get_light_data(void* data)
+int task_get_light_data(void* data)
 {
 	(void)data;
 	// Open the file and check the header
@@ -169,7 +188,7 @@ static int task_get_light_data(void* data)
 	return 0;
 }
 
-static int task_get_microphone_data(void* data)
+int task_get_microphone_data(void* data)
 {
 	(void)data;
 	// Open the file and check the header
@@ -205,7 +224,9 @@ static int task_get_microphone_data(void* data)
 		for (uint32_t j = 0; j < N; j++){
 			in[j] = pi16PDMData[j];
 		}
+		artemia_trace_record(trace, ARTEMIA_TRACE_FFT_BEGIN, 0);
 		max = TestFftReal(&fft, in, out);
+		artemia_trace_record(trace, ARTEMIA_TRACE_FFT_END, 0);
 	}
 
 	// Save frequency with highest amplitude to flash
@@ -215,7 +236,7 @@ static int task_get_microphone_data(void* data)
 	return 0;
 }
 
-static int task_send_lora(void* data)
+int task_send_lora(void* data)
 {
 	(void)data;
 	unsigned char buffer[] = "Hello World! :)";
@@ -224,7 +245,7 @@ static int task_send_lora(void* data)
 
 	am_util_delay_ms(1000);		//wait 1 second
 
-	printf("done sending\r\n");
+	ARTEMIA_LOG_DEBUG("done sending");
 
 	return 0;
 }
@@ -232,6 +253,9 @@ static int task_send_lora(void* data)
 #define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
 
 /*
+ * The static tasks are generated at build time from tasks.json by
+ * tools/scron_tasks.py into a constant table in flash, see tasks.h.
+ *
  * Measured minimum voltages for each task:
  *  - temperature: 1.40
  *  - pressure: 1.85
@@ -242,116 +266,196 @@ static int task_send_lora(void* data)
  *  One caveat-- we can't set a minimum above 2.0, as that's the maximum our
  *  ADC can detect
  */
-static struct scron_task tasks_[] = {
-	{
-		.name = "task_get_temperature_data",
-		.minimum_voltage = 1.8,
-		.function = task_get_temperature_data,
-		.schedule = {
-			.hour = -1,
-			.minute = -1,
-			.second = 10,
-		},
-	},
-	{
-		.name = "task_get_pressure_data",
-		.minimum_voltage = 1.9,
-		.function = task_get_pressure_data,
-		.schedule = {
-			.hour = -1,
-			.minute = -1,
-			.second = 20,
-		},
-	},
-	{
-		.name = "task_get_light_data",
-		.minimum_voltage = 1.8,
-		.function = task_get_light_data,
-		.schedule = {
-			.hour = -1,
-			.minute = -1,
-			.second = 30,
-		},
-	},
+
+// History of every task, appended to a single journal in flash. Around 30
+// records of our 5 tasks fit in 8 KiB before it is compacted
+static const struct scron_journal journal = {
+	.path = "fs:/scron.journal",
+	.temporary_path = "fs:/scron.journal.tmp",
+	.compact_size = 8192,
+};
+
+// The AM1815 has 256 bytes of RAM. The alternate RAM registers, 0x80 through
+// 0xFF, map to either half of it depending on the XADA bit of the extension
+// RAM address register
+#define AM1815_EXTENSION_ADDRESS 0x3F
+#define AM1815_XADA 0x04
+#define AM1815_ALTERNATE_RAM 0x80
+#define AM1815_RAM_SIZE 256
+
+// The RTC RAM holds the history, and at its end, what the alarm is armed with
+#define RTC_RAM_ALARM_ADDRESS (AM1815_RAM_SIZE - SCRON_ALARM_PLAN_SIZE)
+
+#ifndef ARTEMIA_TASK_STATS
+// A history that doesn't fit goes to flash instead, mounting the filesystem on
+// every wake, so adding a task or lengthening a name must not do so silently
+_Static_assert(SCRON_RTC_RAM_HEADER_SIZE + SCRON_STATIC_TASKS_SNAPSHOT_SIZE <=
+	RTC_RAM_ALARM_ADDRESS, "the history of the tasks in tasks.json doesn't fit in the RTC RAM");
+#endif
+
+static void am1815_select_ram_half(size_t address)
+{
+	uint8_t extension = am1815_read_register(&rtc, AM1815_EXTENSION_ADDRESS);
+	uint8_t selected = (extension & ~AM1815_XADA) | ((address & 0x80) ? AM1815_XADA : 0);
+	if (selected != extension)
+		am1815_write_register(&rtc, AM1815_EXTENSION_ADDRESS, selected);
+}
+
+// The RAM is accessed in bursts, each within one half of it, as the register
+// address auto-increments but the half is selected separately
+static bool rtc_ram_read(void *data, size_t address, void *buffer, size_t size)
+{
+	(void)data;
+	uint8_t *bytes = buffer;
+	while (size)
 	{
-		.name = "task_get_microphone_data",
-		.minimum_voltage = 2.00,
-		.function = task_get_microphone_data,
-		.schedule = {
-			.hour = -1,
-			.minute = -1,
-			.second = 40,
-		},
-	},
+		size_t chunk = 0x80 - (address & 0x7F);
+		if (chunk > size)
+			chunk = size;
+		am1815_select_ram_half(address);
+		if (!am1815_read_bulk(&rtc, AM1815_ALTERNATE_RAM | (address & 0x7F), bytes, chunk))
+			return false;
+		bytes += chunk;
+		address += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+static bool rtc_ram_write(void *data, size_t address, const void *buffer, size_t size)
+{
+	(void)data;
+	const uint8_t *bytes = buffer;
+	while (size)
 	{
-		.name = "task_send_lora",
-		.minimum_voltage = 1.8,
-		.function = task_send_lora,
-		.schedule = {
-			.hour = -1,
-			.minute = -1,
-			.second = 50,
-		},
-	},
-};
+		size_t chunk = 0x80 - (address & 0x7F);
+		if (chunk > size)
+			chunk = size;
+		am1815_select_ram_half(address);
+		if (!am1815_write_bulk(&rtc, AM1815_ALTERNATE_RAM | (address & 0x7F), bytes, chunk))
+			return false;
+		bytes += chunk;
+		address += chunk;
+		size -= chunk;
+	}
+	return true;
+}
 
-static struct scron_tasks tasks = {
-	.tasks = tasks_,
-	.size = ARRAY_SIZE(tasks_),
-};
+// Mounting littlefs costs a lot of time and energy, and most wakes don't need
+// it at all, so it is only mounted the first time a task or the journal does
+static bool fs_mounted;
 
-/**
- * The basic gist is to read back the last 2 time_t saved to the file, and if
- * they match we likely don't have any corruption. If they don't go back until
- * we find a matching valid pair.
- */
-static void load_callback(const char *name, time_t *last_run)
+static bool mount_fs(void)
 {
-	char *buf = malloc(strlen(name) + 4 + 1);
-	memcpy(buf, "fs:/", 4);
-	memcpy(buf + 4, name, strlen(name) + 1);
-	FILE *file = fopen(buf, "r");
-	free(buf);
-	if (!file)
+	if (fs_mounted)
+		return true;
+
+	artemia_trace_record(trace, ARTEMIA_TRACE_FS_MOUNT_BEGIN, 0);
+	flash_init(&flash, flash_spi);
+	asimple_littlefs_init(&fs, &flash);
+
+	int err = asimple_littlefs_mount(&fs);
+	if (err < 0)
 	{
-		*last_run = 0;
-		return;
+		asimple_littlefs_format(&fs);
+		err = asimple_littlefs_mount(&fs);
 	}
-	fseek(file, -16, SEEK_END);
-	time_t time1, time2;
-	static_assert(sizeof(time1) == 8, "wrong time_t size guess");
-	do
+	if (err >= 0)
 	{
-		fread(&time1, sizeof(time1), 1, file);
-		fread(&time2, sizeof(time1), 1, file);
-		fseek(file, -32, SEEK_CUR);
-		// FIXME implement tellg so we can tell when we've gone too far back
-	} while (time1 != time2);
-	fclose(file);
+		syscalls_littlefs_init(&fs);
+		fs_mounted = true;
+	}
+	artemia_trace_record(trace, ARTEMIA_TRACE_FS_MOUNT_END, 0);
+	return fs_mounted;
+}
 
-	*last_run = time1;
+// The journal in flash, mounting the filesystem first
+static bool flash_save(void *data, const struct scron *scron, bool full)
+{
+	return mount_fs() && scron_journal_save(data, scron, full);
 }
 
-/**
- * The basic gist is to append to the file (FIXME what if we run out of space?)
- * two time_t, which are checked by load_callback.
- */
-static void save_callback(const char *name, time_t last_run)
+static bool flash_load(void *data, struct scron *scron)
 {
-	char *buf = malloc(strlen(name) + 4 + 1);
-	memcpy(buf, "fs:/", 4);
-	memcpy(buf + 4, name, strlen(name) + 1);
-	FILE *file = fopen(buf, "a");
-	free(buf);
+	return mount_fs() && scron_journal_load(data, scron);
+}
+
+// History is saved to the RTC RAM on every shutdown, which is far cheaper
+// than a flash write. The journal catches up every 64 saves, and takes over
+// if the RTC ever loses its RAM
+static const struct scron_storage flash_storage = {
+	.save = flash_save,
+	.load = flash_load,
+	.data = (void *)&journal,
+};
+static struct scron_rtc_ram_storage rtc_ram = {
+	.read = rtc_ram_read,
+	.write = rtc_ram_write,
+	.size = RTC_RAM_ALARM_ADDRESS,
+	.fallback = &flash_storage,
+	.fallback_interval = 64,
+};
+static struct scron_storage storage;
+
+// What the RTC alarm is armed with. The MCU resets on every wake, so this is
+// kept in the RTC RAM, and is only unknown if the RTC lost power
+static struct scron_alarm_plan armed_alarm;
+
+static void load_armed_alarm(void)
+{
+	uint8_t buffer[SCRON_ALARM_PLAN_SIZE];
+	if (!rtc_ram_read(NULL, RTC_RAM_ALARM_ADDRESS, buffer, sizeof(buffer)) ||
+			!scron_alarm_plan_decode(&armed_alarm, buffer))
+		armed_alarm = (struct scron_alarm_plan){0};
+}
+
+static bool stream_write(void *data, const void *buffer, size_t size)
+{
+	return fwrite(buffer, 1, size, data) == size;
+}
+
+#ifdef ARTEMIA_TRACE
+// Stamps trace events with the DWT cycle counter
+static uint32_t read_cycles(void *data)
+{
+	(void)data;
+	return DWT->CYCCNT;
+}
+
+#define TRACE_PATH "fs:/artemia.trace"
+#define TRACE_OLD_PATH "fs:/artemia.trace.old"
+// Size past which the trace file is rotated, in bytes
+#define TRACE_ROTATE_SIZE 65536
+
+// Dumps the trace of this wake, for tools/artemia_trace.py. Dumping to flash
+// mounts the filesystem on every wake, and dumping to the UART shares it with
+// the log, which the decoder skips over
+static void dump_trace(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+#ifdef ARTEMIA_TRACE_UART
+	artemia_trace_dump(trace, now.tv_sec, stream_write, stdout);
+	fflush(stdout);
+#else
+	if (!mount_fs())
+		return;
+	FILE *file = fopen(TRACE_PATH, "a");
 	if (!file)
-	{
-		// FIXME we should somehow alert that there is a bug or issue
 		return;
-	}
-	fwrite(&last_run, sizeof(last_run), 1, file);
-	fwrite(&last_run, sizeof(last_run), 1, file);
+	artemia_trace_dump(trace, now.tv_sec, stream_write, file);
+	long size = ftell(file);
 	fclose(file);
+	// Like the journal's compaction, this bounds the flash the trace takes,
+	// keeping the newest dumps in two files
+	if (size > TRACE_ROTATE_SIZE)
+	{
+		remove(TRACE_OLD_PATH);
+		rename(TRACE_PATH, TRACE_OLD_PATH);
+	}
+#endif
 }
+#endif
 
 __attribute__((constructor))
 static void redboard_init(void)
@@ -362,12 +466,21 @@ static void redboard_init(void)
 	am_hal_cachectrl_config(&am_hal_cachectrl_defaults);
 	am_hal_cachectrl_enable();
 	am_bsp_low_power_init();
-	am_hal_sysctrl_fpu_enable();
-	am_hal_sysctrl_fpu_stacking_enable(true);
+	// The FPU is left off until a task needs it, see fpu_enable
 
 	// After basic init is done, enable interrupts
 	am_hal_interrupt_master_enable();
 
+#ifdef ARTEMIA_TRACE
+	// Start the cycle counter first, so the trace covers the rest of the wake
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	artemia_trace_init(trace, trace_events, ARRAY_SIZE(trace_events),
+		read_cycles, NULL, AM_HAL_CLKGEN_FREQ_MAX_HZ);
+#endif
+	artemia_log_init(log_buffer, sizeof(log_buffer));
+
 	spi_bus = spi_bus_get_instance(SPI_BUS_0);
 	spi_bus_2 = spi_bus_get_instance(SPI_BUS_1);
 	spi_bus_enable(spi_bus);
@@ -399,16 +512,6 @@ static void redboard_init(void)
     uint8_t OFresult = OF & ~OFmask;
     am1815_write_register(&rtc, 0x1D, OFresult);
 
-	flash_init(&flash, flash_spi);
-	asimple_littlefs_init(&fs, &flash);
-
-	int err = asimple_littlefs_mount(&fs);
-	if (err < 0)
-	{
-		asimple_littlefs_format(&fs);
-		asimple_littlefs_mount(&fs);
-	}
-
 	uart = uart_get_instance(UART_INST0);
 
 	bmp280_init(&bmp280, bmp280_spi);
@@ -424,14 +527,37 @@ static void redboard_init(void)
 
 	syscalls_rtc_init(&rtc);
 	syscalls_uart_init(uart);
-	syscalls_littlefs_init(&fs);
+	// The filesystem is only mounted once something needs it, see mount_fs
 
-	scron_init(&scron, &tasks);
-	scron_load(&scron, load_callback);
+	if (!scron_init(&scron, &scron_static_tasks))
+	{
+		// Without scron there is nothing to do, so save power until the
+		// next wake
+		ARTEMIA_LOG_ERROR("scron_init: out of memory");
+		artemia_log_flush(stream_write, stdout);
+		fflush(stdout);
+		power_control_shutdown(&power_control);
+	}
+#ifdef ARTEMIA_TASK_STATS
+	// The statistics don't fit in the RTC RAM along with the history, so
+	// this saves to flash on every wake
+	scron_enable_stats(&scron);
+#endif
+	// Warm start from the RTC RAM, only mounting the filesystem if the RTC
+	// lost the history
+	scron_storage_init_rtc_ram(&storage, &rtc_ram);
+	artemia_trace_record(trace, ARTEMIA_TRACE_LOAD_BEGIN, 0);
+	scron_storage_load(&storage, &scron);
+	load_armed_alarm();
+	artemia_trace_record(trace, ARTEMIA_TRACE_LOAD_END, 0);
 
 	// initialize systick
 	systick_reset();
 	systick_start();
+
+	// The STIMER times tasks, see read_clock
+	am_hal_stimer_config(AM_HAL_STIMER_CFG_CLEAR | AM_HAL_STIMER_CFG_FREEZE);
+	am_hal_stimer_config(AM_HAL_STIMER_HFRC_3MHZ);
 }
 
 __attribute__((destructor))
@@ -440,13 +566,164 @@ static void redboard_shutdown(void)
 	gpio_set(&lora_enable, false);
 	gpio_set(&adc_enable_vrtc, false);
 	gpio_set(&adc_enable_vadp, false);
-	scron_save(&scron, save_callback);
+	artemia_trace_record(trace, ARTEMIA_TRACE_SAVE_BEGIN, 0);
+	if (!scron_storage_save(&storage, &scron))
+		ARTEMIA_LOG_ERROR("saving the history failed");
+	// Every wake now mounts the filesystem to save, so this needs fixing
+	else if (rtc_ram.too_large)
+		ARTEMIA_LOG_WARNING("history no longer fits in the RTC RAM: %zu bytes",
+			scron_serialized_size(&scron));
+	artemia_trace_record(trace, ARTEMIA_TRACE_SAVE_END, 0);
+#ifdef ARTEMIA_TRACE
+	dump_trace();
+#endif
+	// Every log of the wake goes out in one write, for tools/artemia_log.py
+	artemia_log_flush(stream_write, stdout);
+	fflush(stdout);
 	power_control_shutdown(&power_control);
 }
 
-static double convert_adc_voltage(uint32_t sample)
+// Converts a 14 bit ADC sample, against a 2 V reference, to millivolts,
+// without touching the FPU
+static uint32_t convert_adc_millivolts(uint32_t sample)
+{
+	return (sample * 2000u) / 16383u;
+}
+
+// Only re-reads the storage voltage, used by the scheduler between tasks
+static uint32_t read_storage_millivolts(void *data)
+{
+	(void)data;
+	uint32_t adc_data[2] = {0};
+	uint8_t pins[] = {VRTC_PIN, VADP_PIN};
+	adc_trigger(&adc);
+	while (!(adc_get_sample(&adc, adc_data, pins, ARRAY_SIZE(pins))));
+	return convert_adc_millivolts(adc_data[1]);
+}
+
+// The scheduler only does integer math, so the FPU is only turned on once a
+// task is about to run, and stays off on wakes where nothing does
+static void fpu_enable(void)
+{
+	static bool enabled = false;
+	if (enabled)
+		return;
+	am_hal_sysctrl_fpu_enable();
+	am_hal_sysctrl_fpu_stacking_enable(true);
+	enabled = true;
+}
+
+// Gets the FPU, and the filesystem for the tasks that need it, ready
+static bool prepare_task(void *data, const struct scron_task *task)
+{
+	(void)data;
+	fpu_enable();
+	if (task->flags & SCRON_TASK_NEEDS_FS)
+		return mount_fs();
+	return true;
+}
+
+// STIMER ticks per millisecond. The SysTick's rate is set by asimple and
+// follows the core clock, so tasks are timed by the STIMER instead, at a rate
+// set here
+#define STIMER_TICKS_PER_MS 3000
+
+// Times tasks for their run statistics, in milliseconds. The counter wraps
+// every 23 minutes, so only what elapsed since the last reading is converted,
+// and the milliseconds wrap at 32 bits like the scheduler expects
+static uint32_t read_clock(void *data)
+{
+	(void)data;
+	static uint32_t last_ticks;
+	static uint32_t milliseconds;
+	static uint32_t remainder;
+	uint32_t ticks = am_hal_stimer_counter_get();
+	uint32_t elapsed = ticks - last_ticks;
+	last_ticks = ticks;
+	milliseconds += elapsed / STIMER_TICKS_PER_MS;
+	remainder += elapsed % STIMER_TICKS_PER_MS;
+	if (remainder >= STIMER_TICKS_PER_MS)
+	{
+		milliseconds += 1;
+		remainder -= STIMER_TICKS_PER_MS;
+	}
+	return milliseconds;
+}
+
+// Tasks are chosen by their measured energy use. The storage is the same
+// 47 mF capacitor tools/artemia_sim.c models, and below 1.7 V the MCU browns
+// out. The ADC reads at most 2 V, so above that the available energy is
+// underestimated, never over
+static const struct artemia_config scheduler_config = {
+	.read_millivolts = read_storage_millivolts,
+	.capacitor = {
+		.capacitance = 47000,
+		.floor_voltage = 1700,
+	},
+	.prepare_task = prepare_task,
+	.read_clock = read_clock,
+#ifdef ARTEMIA_TRACE
+	.trace = &trace_buffer,
+#endif
+};
+
+static bool rtc_write_alarm(void *data, time_t time, enum scron_alarm_repeat repeat)
 {
-	return (sample * 2.0) / 16383u;
+	(void)data;
+	struct timeval tv = { .tv_sec = time, };
+	am1815_write_alarm(&rtc, &tv);
+	// The repeat modes are the AM1815 RPT field values, 0 disables the alarm
+	am1815_repeat_alarm(&rtc, repeat);
+	if (repeat != SCRON_ALARM_REPEAT_NONE)
+		am1815_enable_alarm_interrupt(&rtc, AM1815_SHORTEST);
+	return true;
+}
+
+// FIXME the AM1815 driver has no countdown timer support yet, so plans only
+// use the alarm
+static const struct scron_rtc rtc_alarm = {
+	.write_alarm = rtc_write_alarm,
+};
+
+static const struct scron_alarm_config alarm_config = {
+	// Longest a task may wait for another to share a wake with it, in
+	// seconds. Every wake costs a cold boot, so this trades timeliness for
+	// energy. At 40, the tasks at :10 through :50 all share one wake at :50,
+	// which the alarm repeats every minute by itself. Anything shorter
+	// splits them into two wakes a minute, unevenly spaced, so the alarm
+	// has to be written on every wake
+	.tolerance = 40,
+	// Tasks that were due but couldn't run are retried a minute later
+	.retry = 60,
+	.countdown = false,
+};
+
+// Arms the RTC for the next wake, unless it already fires then
+static void arm_alarm(time_t now)
+{
+	if (scron_alarm_is_current(&scron, &alarm_config, &armed_alarm, now))
+	{
+		ARTEMIA_LOG_DEBUG("alarm already armed, period: %" PRIu32, armed_alarm.period);
+		return;
+	}
+
+	struct scron_alarm_plan plan;
+	if (!scron_alarm_plan(&scron, &alarm_config, now, &plan))
+	{
+		ARTEMIA_LOG_INFO("no tasks left to schedule");
+		return;
+	}
+	ARTEMIA_LOG_INFO("next alarm in: %lld, period: %" PRIu32,
+		(long long)(plan.wake - now), plan.period);
+	uint8_t previous[SCRON_ALARM_PLAN_SIZE];
+	scron_alarm_plan_encode(&armed_alarm, previous);
+	// If writing the RTC failed partway, what it's armed with is unknown
+	if (!scron_alarm_arm(&rtc_alarm, &plan, &armed_alarm, now))
+		armed_alarm = (struct scron_alarm_plan){0};
+	uint8_t current[SCRON_ALARM_PLAN_SIZE];
+	scron_alarm_plan_encode(&armed_alarm, current);
+	if (memcmp(previous, current, sizeof(current)))
+		rtc_ram_write(NULL, RTC_RAM_ALARM_ADDRESS, current, sizeof(current));
 }
 
 int main(void)
@@ -478,6 +755,7 @@ int main(void)
 				am1815_write_time(&rtc, &now);
 				//gettimeofday(&now, NULL);
 				now = am1815_read_time(&rtc);
+				scron_invalidate_next_runs(&scron);
 			}
 		}
 		// end of FIXME
@@ -486,25 +764,33 @@ int main(void)
 		uint8_t pins[] = {VRTC_PIN, VADP_PIN};
 		while (!(adc_get_sample(&adc, adc_data, pins, ARRAY_SIZE(pins))));
 
-		double current_voltage = convert_adc_voltage(adc_data[1]);
+		uint32_t current_voltage = convert_adc_millivolts(adc_data[1]);
 		time_t now_s = now.tv_sec;
 
-		bool ran_task = artemia_scheduler(&scron, current_voltage, now_s);
-		if (!ran_task)
+		// Run every task that is due and affordable in one batch, then check
+		// again in case more became due while they ran
+		struct artemia_stats stats;
+		size_t ran_tasks = artemia_scheduler_batch_millivolts(&scron, &scheduler_config,
+			current_voltage, now_s, &stats);
+		if (stats.missed)
+			ARTEMIA_LOG_WARNING("missed deadlines: %zu", stats.missed);
+		if (!ran_tasks)
 		{
 			// Time is stale here, as task could have taken non-negligible time
 			// to run
 			gettimeofday(&now, NULL);
+#if ARTEMIA_LOG_LEVEL >= ARTEMIA_LOG_LEVEL_DEBUG
+			// Only worth converting the time for the debug log
 			struct tm tm;
 			gmtime_r(&now.tv_sec, &tm);
-			printf("current seconds: %lu\r\n", (uint32_t)tm.tm_sec);
-			// Reconfigure the alarm
-			time_t next = scron_next_time(&scron);
-			printf("next alarm in: %lu\r\n", (uint32_t)(next - now.tv_sec));
-			struct timeval tv = { .tv_sec = next, };
-			am1815_write_alarm(&rtc, &tv);
-			am1815_repeat_alarm(&rtc, 6); // Repeat every FIXME minute
-			am1815_enable_alarm_interrupt(&rtc, AM1815_SHORTEST);
+			ARTEMIA_LOG_DEBUG("current seconds: %d", tm.tm_sec);
+#endif
+			// Reconfigure the alarm, for when the next tasks close together
+			// are all due. If the wakes are periodic and the alarm already
+			// repeats at them, the RTC is left alone
+			artemia_trace_record(trace, ARTEMIA_TRACE_ALARM_BEGIN, 0);
+			arm_alarm(now.tv_sec);
+			artemia_trace_record(trace, ARTEMIA_TRACE_ALARM_END, 0);
 			break;
 		}
 	}
@@ -6,13 +6,21 @@
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
-#include <limits.h>
-
-//FIXME DEBUG
-#include <stdio.h>
+#include <stdbool.h>
 
 time_t scron_schedule_next_time(const struct scron_schedule *sched, time_t now)
 {
+	if (sched->period)
+	{
+		time_t offset = (now - (time_t)sched->phase) % (time_t)sched->period;
+		if (offset < 0)
+			offset += sched->period;
+		return now + sched->period - offset;
+	}
+
+	if (sched->cron.seconds)
+		return scron_cron_next_time(&sched->cron, now);
+
 	time_t next = now;
 	// If everything is negative, trigger the next second
 	if (sched->second < 0 && sched->minute < 0 && sched->hour < 0)
@@ -23,11 +31,18 @@ time_t scron_schedule_next_time(const struct scron_schedule *sched, time_t now)
 	}
 
 	// From here on out, we know we don't have all sched components as
-	// negatives
-	struct tm now_tm = *gmtime(&now);
+	// negatives. time_t counts seconds from the epoch without leap seconds, so
+	// the UTC time of day is just the remainder of a day's worth of seconds
+	time_t day = now % 86400;
+	if (day < 0)
+		day += 86400;
+	const int hour = day / 3600;
+	const int minute = (day / 60) % 60;
+	const int second = day % 60;
+
 	if (sched->hour >= 0)
 	{
-		int diff = (sched->hour - now_tm.tm_hour) * 3600;
+		int diff = (sched->hour - hour) * 3600;
 		if (diff < 0)
 		{
 			diff += 3600 * 24;
@@ -36,7 +51,7 @@ time_t scron_schedule_next_time(const struct scron_schedule *sched, time_t now)
 	}
 	if (sched->minute >= 0)
 	{
-		int diff = (sched->minute - now_tm.tm_min) * 60;
+		int diff = (sched->minute - minute) * 60;
 		if (diff < 0)
 		{
 			diff += 3600;
@@ -45,7 +60,7 @@ time_t scron_schedule_next_time(const struct scron_schedule *sched, time_t now)
 	}
 	if (sched->second >= 0)
 	{
-		int diff = (sched->second - now_tm.tm_sec);
+		int diff = (sched->second - second);
 		if (diff < 0)
 		{
 			diff += 60;
@@ -69,13 +84,355 @@ time_t scron_schedule_next_time(const struct scron_schedule *sched, time_t now)
 	return next;
 }
 
-void scron_init(struct scron *scron, struct scron_tasks *static_tasks)
+void scron_schedule_next_times(const struct scron_task *tasks, size_t count,
+	const struct scron_task_history *history, time_t *next)
+{
+	for (size_t i = 0; i < count; ++i)
+		next[i] = scron_schedule_next_time(&tasks[i].schedule, history[i].last_run);
+}
+
+static bool scron_queue_less(const struct scron *scron, size_t a, size_t b)
+{
+	const struct scron_queue *queue = &scron->queue;
+	return queue->next[queue->heap[a]] < queue->next[queue->heap[b]];
+}
+
+static void scron_queue_swap(struct scron *scron, size_t a, size_t b)
+{
+	struct scron_queue *queue = &scron->queue;
+	size_t tmp = queue->heap[a];
+	queue->heap[a] = queue->heap[b];
+	queue->heap[b] = tmp;
+	queue->position[queue->heap[a]] = a;
+	queue->position[queue->heap[b]] = b;
+}
+
+static void scron_queue_sift_up(struct scron *scron, size_t pos)
+{
+	while (pos > 0)
+	{
+		size_t parent = (pos - 1) / 2;
+		if (!scron_queue_less(scron, pos, parent))
+			break;
+		scron_queue_swap(scron, pos, parent);
+		pos = parent;
+	}
+}
+
+// Sifts down within the first count heap entries, which may be fewer than
+// the number of tasks while one is being removed
+static void scron_queue_sift_down(struct scron *scron, size_t pos, size_t count)
+{
+	for (;;)
+	{
+		size_t smallest = pos;
+		size_t left = pos * 2 + 1;
+		size_t right = left + 1;
+		if (left < count && scron_queue_less(scron, left, smallest))
+			smallest = left;
+		if (right < count && scron_queue_less(scron, right, smallest))
+			smallest = right;
+		if (smallest == pos)
+			break;
+		scron_queue_swap(scron, pos, smallest);
+		pos = smallest;
+	}
+}
+
+// Reloads the next run time of every task from the history, working out the
+// ones that aren't cached, and reorders the whole heap
+static void scron_queue_rebuild(struct scron *scron)
+{
+	struct scron_queue *queue = &scron->queue;
+	const size_t count = scron_get_task_count(scron);
+	for (size_t i = 0; i < count; ++i)
+	{
+		struct scron_task_history *history = &scron->history[i];
+		if (history->next_run <= history->last_run)
+			history->next_run = scron_schedule_next_time(
+				&scron_get_task(scron, i)->schedule, history->last_run);
+		queue->next[i] = history->next_run;
+		queue->heap[i] = i;
+		queue->position[i] = i;
+	}
+
+	for (size_t i = count / 2; i > 0; --i)
+		scron_queue_sift_down(scron, i - 1, count);
+}
+
+// Moves the task at run order position from to position to, shifting the
+// tasks in between by one
+static void scron_order_move(struct scron *scron, size_t from, size_t to)
+{
+	struct scron_run_order *run_order = &scron->run_order;
+	size_t index = run_order->order[from];
+	size_t low = from < to ? from : to;
+	size_t high = from < to ? to : from;
+	if (from < to)
+		memmove(&run_order->order[from], &run_order->order[from + 1],
+			sizeof(run_order->order[0]) * (to - from));
+	else
+		memmove(&run_order->order[to + 1], &run_order->order[to],
+			sizeof(run_order->order[0]) * (from - to));
+	run_order->order[to] = index;
+	for (size_t i = low; i <= high; ++i)
+		run_order->rank[run_order->order[i]] = i;
+}
+
+struct order_entry
+{
+	time_t last_run;
+	size_t index;
+};
+
+static int order_entry_compare(const void *a, const void *b)
+{
+	const struct order_entry *a_ = a;
+	const struct order_entry *b_ = b;
+	if (a_->last_run != b_->last_run)
+		return a_->last_run < b_->last_run ? -1 : 1;
+	if (a_->index != b_->index)
+		return a_->index < b_->index ? -1 : 1;
+	return 0;
+}
+
+// Sorts the whole run order by the last run time in the history. This is
+// only needed when the whole history changes, e.g. after loading it
+static void scron_order_rebuild(struct scron *scron)
+{
+	struct scron_run_order *run_order = &scron->run_order;
+	const size_t count = scron_get_task_count(scron);
+	struct order_entry *entries = malloc(sizeof(*entries) * count);
+	if (!entries)
+	{
+		// Fall back to index order, which is still a valid order
+		for (size_t i = 0; i < count; ++i)
+		{
+			run_order->order[i] = i;
+			run_order->rank[i] = i;
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		entries[i].last_run = scron->history[i].last_run;
+		entries[i].index = i;
+	}
+	qsort(entries, count, sizeof(*entries), order_entry_compare);
+	for (size_t i = 0; i < count; ++i)
+	{
+		run_order->order[i] = entries[i].index;
+		run_order->rank[entries[i].index] = i;
+	}
+	free(entries);
+}
+
+uint32_t scron_hash_name(const char *name)
+{
+	uint32_t hash = UINT32_C(2166136261);
+	for (const unsigned char *c = (const unsigned char *)name; *c; ++c)
+	{
+		hash ^= *c;
+		hash *= UINT32_C(16777619);
+	}
+	return hash;
+}
+
+static void scron_names_insert(struct scron *scron, size_t index)
+{
+	struct scron_name_index *names = &scron->names;
+	const size_t mask = names->capacity - 1;
+	uint32_t hash = scron_hash_name(scron_get_task(scron, index)->name);
+	size_t slot = hash & mask;
+	while (names->slots[slot].index != SCRON_NAME_EMPTY)
+		slot = (slot + 1) & mask;
+	names->slots[slot].hash = hash;
+	names->slots[slot].index = index;
+}
+
+// Makes sure the name index has room for count tasks, rebuilding it with
+// every task if it has to grow
+static bool scron_names_reserve(struct scron *scron, size_t count)
+{
+	struct scron_name_index *names = &scron->names;
+	size_t capacity = names->capacity ? names->capacity : 8;
+	while (capacity < count * 2)
+		capacity *= 2;
+	if (capacity == names->capacity)
+		return true;
+
+	struct scron_name_slot *slots = realloc(names->slots, sizeof(*slots) * capacity);
+	if (!slots)
+		return false;
+	names->slots = slots;
+	names->capacity = capacity;
+	for (size_t i = 0; i < capacity; ++i)
+		slots[i].index = SCRON_NAME_EMPTY;
+	const size_t task_count = scron_get_task_count(scron);
+	for (size_t i = 0; i < task_count; ++i)
+		scron_names_insert(scron, i);
+	return true;
+}
+
+// Resizes all per-task arrays to hold at least capacity tasks in total. If
+// this fails partway, the arrays already grown are left larger than needed,
+// which is harmless, as callers only use the new capacity once every array
+// has it, and their contents are untouched
+static bool scron_reserve(struct scron *scron, size_t capacity)
+{
+	struct scron_task_history *history = realloc(scron->history, sizeof(*history) * capacity);
+	if (!history)
+		return false;
+	scron->history = history;
+
+	if (scron->stats)
+	{
+		struct scron_task_stats *stats = realloc(scron->stats, sizeof(*stats) * capacity);
+		if (!stats)
+			return false;
+		scron->stats = stats;
+	}
+
+	size_t *heap = realloc(scron->queue.heap, sizeof(*heap) * capacity);
+	if (!heap)
+		return false;
+	scron->queue.heap = heap;
+
+	size_t *position = realloc(scron->queue.position, sizeof(*position) * capacity);
+	if (!position)
+		return false;
+	scron->queue.position = position;
+
+	time_t *next = realloc(scron->queue.next, sizeof(*next) * capacity);
+	if (!next)
+		return false;
+	scron->queue.next = next;
+
+	size_t *order = realloc(scron->run_order.order, sizeof(*order) * capacity);
+	if (!order)
+		return false;
+	scron->run_order.order = order;
+
+	size_t *rank = realloc(scron->run_order.rank, sizeof(*rank) * capacity);
+	if (!rank)
+		return false;
+	scron->run_order.rank = rank;
+
+	// There are never more handle slots in use than tasks, as removed tasks
+	// free their slots for reuse
+	struct scron_handle_slot *slots = realloc(scron->handles.slots, sizeof(*slots) * capacity);
+	if (!slots)
+		return false;
+	scron->handles.slots = slots;
+
+	uint32_t *task_slot = realloc(scron->handles.task_slot, sizeof(*task_slot) * capacity);
+	if (!task_slot)
+		return false;
+	scron->handles.task_slot = task_slot;
+
+	bool *dirty = realloc(scron->dirty.entries, sizeof(*dirty) * capacity);
+	if (!dirty)
+		return false;
+	scron->dirty.entries = dirty;
+
+	uint16_t *minimum_voltage = realloc(scron->hot.minimum_voltage, sizeof(*minimum_voltage) * capacity);
+	if (!minimum_voltage)
+		return false;
+	scron->hot.minimum_voltage = minimum_voltage;
+
+	time_t *window = realloc(scron->hot.window, sizeof(*window) * capacity);
+	if (!window)
+		return false;
+	scron->hot.window = window;
+
+	uint8_t *state = realloc(scron->hot.state, sizeof(*state) * capacity);
+	if (!state)
+		return false;
+	scron->hot.state = state;
+	return true;
+}
+
+// Copies the fields the scan needs of a task into the hot data
+static void scron_hot_set(struct scron *scron, size_t index, const struct scron_task *task)
+{
+	scron->hot.minimum_voltage[index] = task->minimum_millivolts;
+	scron->hot.window[index] = task->delta > 0 ? task->delta : SCRON_NEVER;
+	scron->hot.state[index] = SCRON_SCAN_WAITING;
+}
+
+// Finds the name index slot of the task at index
+static size_t scron_names_find(const struct scron *scron, size_t index)
+{
+	const struct scron_name_index *names = &scron->names;
+	const size_t mask = names->capacity - 1;
+	size_t slot = scron_hash_name(scron_get_task(scron, index)->name) & mask;
+	while (names->slots[slot].index != index)
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+// Removes a slot from the name index, shifting back the entries after it so
+// no lookup chain is broken
+static void scron_names_remove(struct scron *scron, size_t slot)
+{
+	struct scron_name_index *names = &scron->names;
+	const size_t mask = names->capacity - 1;
+	size_t next = (slot + 1) & mask;
+	while (names->slots[next].index != SCRON_NAME_EMPTY)
+	{
+		// An entry can only move back if that doesn't put it before its home
+		size_t home = names->slots[next].hash & mask;
+		if (((next - home) & mask) >= ((next - slot) & mask))
+		{
+			names->slots[slot] = names->slots[next];
+			slot = next;
+		}
+		next = (next + 1) & mask;
+	}
+	names->slots[slot].index = SCRON_NAME_EMPTY;
+}
+
+bool scron_init(struct scron *scron, const struct scron_tasks *static_tasks)
 {
 	scron->static_tasks = *static_tasks;
 	memset(&scron->runtime_tasks, 0, sizeof(scron->runtime_tasks));
-	scron->history = malloc(sizeof(scron->history[0]) * static_tasks->size);
-	memset(scron->history, 0, sizeof(scron->history[0]) * static_tasks->size);
 	scron->runtime_capacity = 0;
+	scron->history = NULL;
+	scron->stats = NULL;
+	memset(&scron->queue, 0, sizeof(scron->queue));
+	memset(&scron->run_order, 0, sizeof(scron->run_order));
+	memset(&scron->names, 0, sizeof(scron->names));
+	memset(&scron->handles, 0, sizeof(scron->handles));
+	memset(&scron->dirty, 0, sizeof(scron->dirty));
+	memset(&scron->hot, 0, sizeof(scron->hot));
+	// realloc of 0 bytes may return NULL, so always make room for one task
+	const size_t capacity = static_tasks->size ? static_tasks->size : 1;
+	if (!scron_reserve(scron, capacity) || !scron_names_reserve(scron, static_tasks->size))
+	{
+		scron_delete(scron);
+		return false;
+	}
+	memset(scron->history, 0, sizeof(scron->history[0]) * static_tasks->size);
+	scron_queue_rebuild(scron);
+	for (size_t i = 0; i < static_tasks->size; ++i)
+	{
+		scron->run_order.order[i] = i;
+		scron->run_order.rank[i] = i;
+		// Static tasks are never removed, so they keep their slots forever
+		scron->handles.slots[i].index = i;
+		scron->handles.slots[i].generation = 0;
+		scron->handles.task_slot[i] = i;
+		scron_hot_set(scron, i, &static_tasks->tasks[i]);
+	}
+	scron->handles.count = static_tasks->size;
+	scron->handles.free = SCRON_HANDLE_INVALID;
+
+	// Nothing has been persisted yet
+	for (size_t i = 0; i < static_tasks->size; ++i)
+		scron->dirty.entries[i] = true;
+	scron->dirty.layout = true;
+	return true;
 }
 
 void scron_delete(struct scron *scron)
@@ -85,6 +442,32 @@ void scron_delete(struct scron *scron)
 		free(scron->history);
 		scron->history = NULL;
 	}
+	free(scron->stats);
+	scron->stats = NULL;
+
+	free(scron->queue.heap);
+	free(scron->queue.position);
+	free(scron->queue.next);
+	memset(&scron->queue, 0, sizeof(scron->queue));
+
+	free(scron->run_order.order);
+	free(scron->run_order.rank);
+	memset(&scron->run_order, 0, sizeof(scron->run_order));
+
+	free(scron->names.slots);
+	memset(&scron->names, 0, sizeof(scron->names));
+
+	free(scron->handles.slots);
+	free(scron->handles.task_slot);
+	memset(&scron->handles, 0, sizeof(scron->handles));
+
+	free(scron->dirty.entries);
+	memset(&scron->dirty, 0, sizeof(scron->dirty));
+
+	free(scron->hot.minimum_voltage);
+	free(scron->hot.window);
+	free(scron->hot.state);
+	memset(&scron->hot, 0, sizeof(scron->hot));
 
 	if (scron->runtime_tasks.tasks)
 	{
@@ -92,32 +475,153 @@ void scron_delete(struct scron *scron)
 		scron->runtime_tasks.tasks = NULL;
 		scron->runtime_tasks.size = 0;
 	}
+	scron->runtime_capacity = 0;
 }
 
-void scron_add_task(struct scron *scron, const struct scron_task *task)
+struct scron_handle scron_add_task(struct scron *scron, const struct scron_task *task)
 {
-	if (scron->runtime_tasks.tasks == NULL)
-	{
-		scron->runtime_tasks.tasks = malloc(sizeof(scron->runtime_tasks.tasks[0]) * 2);
-		scron->runtime_capacity = 2;
-		scron->runtime_tasks.size = 0;
-	}
+	const struct scron_handle invalid = { .slot = SCRON_HANDLE_INVALID };
+	// Make room for the task everywhere before changing anything, so running
+	// out of memory leaves scron as it was
 	size_t index = scron->runtime_tasks.size;
 	if (index >= scron->runtime_capacity)
 	{
-		struct scron_task *tasks = scron->runtime_tasks.tasks;
-		size_t new_size = sizeof(tasks[0]) * scron->runtime_capacity * 2;
-		scron->runtime_tasks.tasks = realloc(tasks, new_size);
-		// FIXME what if alloc failed?
-		scron->runtime_capacity *= 2;
+		size_t capacity = scron->runtime_capacity ? scron->runtime_capacity * 2 : 2;
+		struct scron_task *tasks = realloc(scron->runtime_tasks.tasks,
+			sizeof(tasks[0]) * capacity);
+		if (!tasks)
+			return invalid;
+		scron->runtime_tasks.tasks = tasks;
+		if (!scron_reserve(scron, scron->static_tasks.size + capacity))
+			return invalid;
+		scron->runtime_capacity = capacity;
 	}
+	if (!scron_names_reserve(scron, scron_get_task_count(scron) + 1))
+		return invalid;
+
 	scron->runtime_tasks.tasks[index] = *task;
 	scron->runtime_tasks.size += 1;
+	size_t task_count = scron_get_task_count(scron);
+	scron_names_insert(scron, task_count - 1);
+
+	// New tasks have never run, and go to the bottom of the heap first
+	size_t task_index = scron->static_tasks.size + index;
+	memset(&scron->history[task_index], 0, sizeof(scron->history[0]));
+	if (scron->stats)
+		memset(&scron->stats[task_index], 0, sizeof(scron->stats[0]));
+	scron_hot_set(scron, task_index, task);
+	scron->history[task_index].next_run = scron_schedule_next_time(&task->schedule, 0);
+	scron->queue.next[task_index] = scron->history[task_index].next_run;
+	scron->queue.heap[task_index] = task_index;
+	scron->queue.position[task_index] = task_index;
+	scron_queue_sift_up(scron, task_index);
+	scron->dirty.entries[task_index] = true;
+	scron->dirty.layout = true;
+
+	// And go to the front of the run order, as they are the least recently run
+	scron->run_order.order[task_index] = task_index;
+	scron->run_order.rank[task_index] = task_index;
+	scron_order_move(scron, task_index, 0);
+
+	// Reuse a freed handle slot if there is one, keeping its generation so
+	// old handles to it stay invalid
+	struct scron_handles *handles = &scron->handles;
+	uint32_t slot = handles->free;
+	if (slot != SCRON_HANDLE_INVALID)
+	{
+		handles->free = handles->slots[slot].index;
+	}
+	else
+	{
+		slot = handles->count++;
+		handles->slots[slot].generation = 0;
+	}
+	handles->slots[slot].index = task_index;
+	handles->task_slot[task_index] = slot;
+	return scron_get_handle(scron, task_index);
 }
 
-void scron_del_task(struct scron *scron, size_t index)
+bool scron_del_task(struct scron *scron, size_t index)
 {
-	// FIXME
+	const size_t count = scron_get_task_count(scron);
+	if (index < scron->static_tasks.size || index >= count)
+		return false;
+	const size_t last = count - 1;
+
+	// Take the task out of the heap, putting the last heap entry in its place
+	struct scron_queue *queue = &scron->queue;
+	size_t pos = queue->position[index];
+	if (pos != last)
+	{
+		scron_queue_swap(scron, pos, last);
+		size_t moved = queue->heap[pos];
+		scron_queue_sift_up(scron, pos);
+		scron_queue_sift_down(scron, queue->position[moved], last);
+	}
+
+	// Then out of the run order, the name index, and the handle table
+	scron_order_move(scron, scron->run_order.rank[index], last);
+	scron_names_remove(scron, scron_names_find(scron, index));
+
+	struct scron_handles *handles = &scron->handles;
+	uint32_t slot = handles->task_slot[index];
+	handles->slots[slot].generation += 1;
+	handles->slots[slot].index = handles->free;
+	handles->free = slot;
+
+	// The last task moves into the hole left behind, so everything that
+	// refers to it by index needs to follow it
+	if (index != last)
+	{
+		size_t runtime_index = index - scron->static_tasks.size;
+		scron->names.slots[scron_names_find(scron, last)].index = index;
+		scron->runtime_tasks.tasks[runtime_index] = scron->runtime_tasks.tasks[last - scron->static_tasks.size];
+		scron->history[index] = scron->history[last];
+		if (scron->stats)
+			scron->stats[index] = scron->stats[last];
+		scron->hot.minimum_voltage[index] = scron->hot.minimum_voltage[last];
+		scron->hot.window[index] = scron->hot.window[last];
+		scron->hot.state[index] = scron->hot.state[last];
+
+		queue->next[index] = queue->next[last];
+		queue->position[index] = queue->position[last];
+		queue->heap[queue->position[index]] = index;
+
+		scron->run_order.rank[index] = scron->run_order.rank[last];
+		scron->run_order.order[scron->run_order.rank[index]] = index;
+
+		handles->task_slot[index] = handles->task_slot[last];
+		handles->slots[handles->task_slot[index]].index = index;
+
+		scron->dirty.entries[index] = true;
+	}
+	scron->dirty.layout = true;
+
+	scron->runtime_tasks.size -= 1;
+	return true;
+}
+
+struct scron_handle scron_get_handle(const struct scron *scron, size_t index)
+{
+	uint32_t slot = scron->handles.task_slot[index];
+	struct scron_handle handle = {
+		.slot = slot,
+		.generation = scron->handles.slots[slot].generation,
+	};
+	return handle;
+}
+
+bool scron_resolve_handle(const struct scron *scron, struct scron_handle handle,
+	size_t *index)
+{
+	const struct scron_handles *handles = &scron->handles;
+	if (handle.slot >= handles->count)
+		return false;
+	const struct scron_handle_slot *slot = &handles->slots[handle.slot];
+	if (slot->generation != handle.generation)
+		return false;
+	*index = slot->index;
+	return true;
 }
 
 size_t scron_get_task_count(const struct scron *scron)
@@ -127,29 +631,349 @@ size_t scron_get_task_count(const struct scron *scron)
 
 time_t scron_next_time(const struct scron *scron)
 {
-	size_t count = scron_get_task_count(scron);
-	if (!count)
+	size_t index = scron_next_task(scron);
+	if (index == scron_get_task_count(scron))
 		return 0;
+	return scron->queue.next[index];
+}
 
-	time_t result = INT_MAX; // FIXME is there a better maximum??? Also the standard makes no assumptions
-	for (size_t i = 0; i < scron->static_tasks.size; ++i)
+size_t scron_next_task(const struct scron *scron)
+{
+	if (!scron_get_task_count(scron))
+		return 0;
+	return scron->queue.heap[0];
+}
+
+time_t scron_task_window_end(const struct scron_task *task, time_t next,
+	time_t tolerance)
+{
+	time_t slack = tolerance > 0 ? tolerance : 0;
+	// Tasks count as missed once they're delta seconds late
+	if (task->delta > 0 && task->delta - 1 < slack)
+		slack = task->delta - 1;
+	if (next > SCRON_NEVER - slack)
+		return SCRON_NEVER;
+	return next + slack;
+}
+
+static time_t scron_wake_window_end(const struct scron *scron, size_t index,
+	time_t tolerance)
+{
+	return scron_task_window_end(scron_get_task(scron, index),
+		scron->queue.next[index], tolerance);
+}
+
+// Inserts a task into tasks, sorted by next run time. If tasks is full, the
+// task that runs last is dropped
+static void scron_wake_insert(const struct scron *scron, size_t *tasks,
+	size_t *count, size_t capacity, size_t index)
+{
+	const time_t *next = scron->queue.next;
+	size_t pos = *count;
+	if (pos == capacity)
 	{
-		time_t last_run = scron->history[i].last_run;
-		time_t next = scron_schedule_next_time(&scron->static_tasks.tasks[i].schedule, last_run);
-		printf("scron: %s last: %lu next: %lu\r\n", scron->static_tasks.tasks[i].name, (uint32_t)last_run, (uint32_t)next);
-		if (result > next)
-			result = next;
+		if (next[tasks[pos - 1]] <= next[index])
+			return;
+		pos -= 1;
+	}
+	else
+	{
+		*count += 1;
+	}
+	while (pos > 0 && next[tasks[pos - 1]] > next[index])
+	{
+		tasks[pos] = tasks[pos - 1];
+		--pos;
 	}
+	tasks[pos] = index;
+}
 
-	for (size_t i = 0; i < scron->runtime_tasks.size; ++i)
+size_t scron_next_wake(const struct scron *scron, time_t tolerance,
+	time_t *wake, size_t *tasks, size_t capacity)
+{
+	const struct scron_queue *queue = &scron->queue;
+	const size_t task_count = scron_get_task_count(scron);
+	if (!task_count)
 	{
-		time_t last_run = scron->history[i + scron->static_tasks.size].last_run;
-		time_t next = scron_schedule_next_time(&scron->runtime_tasks.tasks[i].schedule, last_run);
-		if (result > next)
-			result = next;
+		*wake = 0;
+		return 0;
+	}
+	if (queue->next[queue->heap[0]] == SCRON_NEVER)
+	{
+		*wake = SCRON_NEVER;
+		return 0;
+	}
+
+	// Nothing can share the wake with the first task after its window
+	// closes, and the tasks due by then are a subtree at the top of the
+	// heap, walked here without a stack
+	const time_t limit = scron_wake_window_end(scron, queue->heap[0], tolerance);
+	size_t count = 0;
+	size_t pos = 0;
+	for (;;)
+	{
+		scron_wake_insert(scron, tasks, &count, capacity, queue->heap[pos]);
+		size_t left = pos * 2 + 1;
+		if (left < task_count && queue->next[queue->heap[left]] <= limit)
+		{
+			pos = left;
+			continue;
+		}
+		// Climb from the left child, whether or not it's there, until there's
+		// a right sibling left to visit
+		pos = left;
+		while (pos > 0)
+		{
+			size_t sibling = pos + 1;
+			if ((pos & 1) && sibling < task_count &&
+					queue->next[queue->heap[sibling]] <= limit)
+				break;
+			pos = (pos - 1) / 2;
+		}
+		if (!pos)
+			break;
+		pos += 1;
+	}
+
+	return scron_join_wake(scron, tolerance, queue->next, tasks, count, wake);
+}
+
+size_t scron_join_wake(const struct scron *scron, time_t tolerance,
+	const time_t *next, const size_t *tasks, size_t count, time_t *wake)
+{
+	// Tasks join in order of their next run, for as long as it falls within
+	// the window of every task that joined before
+	time_t end = SCRON_NEVER;
+	size_t selected = 0;
+	for (; selected < count; ++selected)
+	{
+		size_t index = tasks[selected];
+		if (next[index] > end)
+			break;
+		time_t window_end = scron_task_window_end(scron_get_task(scron, index),
+			next[index], tolerance);
+		if (window_end < end)
+			end = window_end;
+	}
+	*wake = next[tasks[selected - 1]];
+	return selected;
+}
+
+time_t scron_get_next_run(const struct scron *scron, size_t index)
+{
+	return scron->queue.next[index];
+}
+
+void scron_record_energy(struct scron *scron, size_t index, uint32_t energy)
+{
+	struct scron_task_history *history = &scron->history[index];
+	// Exponentially weighted moving average, with the newest sample weighing
+	// a quarter, so one noisy measurement can't swing the estimate too far.
+	// 0 means unknown, so a task measured as free is recorded as 1 uJ
+	if (!history->energy)
+		history->energy = energy ? energy : 1;
+	else
+		history->energy = (history->energy * UINT64_C(3) + energy + 2) / 4;
+	scron->dirty.entries[index] = true;
+}
+
+bool scron_enable_stats(struct scron *scron)
+{
+	if (scron->stats)
+		return true;
+	const size_t capacity = scron->static_tasks.size + scron->runtime_capacity;
+	scron->stats = calloc(capacity ? capacity : 1, sizeof(*scron->stats));
+	if (!scron->stats)
+		return false;
+
+	// Every snapshot entry grows to make room for them
+	const size_t count = scron_get_task_count(scron);
+	for (size_t i = 0; i < count; ++i)
+		scron->dirty.entries[i] = true;
+	scron->dirty.layout = true;
+	return true;
+}
+
+const struct scron_task_stats *scron_get_stats(const struct scron *scron, size_t index)
+{
+	if (!scron->stats)
+		return NULL;
+	return &scron->stats[index];
+}
+
+static uint16_t saturate_u16(uint32_t value)
+{
+	return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+static uint32_t saturating_add(uint32_t a, uint32_t b)
+{
+	return a > UINT32_MAX - b ? UINT32_MAX : a + b;
+}
+
+void scron_record_run(struct scron *scron, size_t index, time_t lateness,
+	uint32_t duration, uint32_t voltage)
+{
+	if (!scron->stats)
+		return;
+	struct scron_task_stats *stats = &scron->stats[index];
+
+	// Bucket i > 0 holds lateness from 2^(i-1) through 2^i - 1 seconds
+	size_t bucket = 0;
+	while (bucket < SCRON_LATENESS_BUCKETS - 1 && lateness >= ((time_t)1 << bucket))
+		++bucket;
+	if (stats->lateness[bucket] < UINT16_MAX)
+		stats->lateness[bucket] += 1;
+
+	uint16_t millis = saturate_u16(duration);
+	uint16_t millivolts = saturate_u16(voltage);
+	if (!stats->runs)
+	{
+		stats->duration_min = millis;
+		stats->duration_max = millis;
+		stats->voltage_min = millivolts;
+		stats->voltage_average = millivolts;
+	}
+	else
+	{
+		if (millis < stats->duration_min)
+			stats->duration_min = millis;
+		if (millis > stats->duration_max)
+			stats->duration_max = millis;
+		if (millivolts < stats->voltage_min)
+			stats->voltage_min = millivolts;
+		// Same weighting as the energy estimate
+		stats->voltage_average = (stats->voltage_average * UINT32_C(3) + millivolts + 2) / 4;
+	}
+	stats->duration_total = saturating_add(stats->duration_total, duration);
+	stats->runs = saturating_add(stats->runs, 1);
+	scron->dirty.entries[index] = true;
+}
+
+void scron_record_voltage_skip(struct scron *scron, size_t index)
+{
+	if (!scron->stats)
+		return;
+	scron->stats[index].voltage_skips = saturating_add(scron->stats[index].voltage_skips, 1);
+	scron->dirty.entries[index] = true;
+}
+
+void scron_record_miss(struct scron *scron, size_t index)
+{
+	if (!scron->stats)
+		return;
+	scron->stats[index].missed = saturating_add(scron->stats[index].missed, 1);
+	scron->dirty.entries[index] = true;
+}
+
+size_t scron_get_run_order(const struct scron *scron, size_t position)
+{
+	return scron->run_order.order[position];
+}
+
+// Updates the cached next run time of a task, and its place in the queue
+static void scron_queue_update(struct scron *scron, size_t index, time_t next)
+{
+	time_t old_next = scron->queue.next[index];
+	scron->queue.next[index] = next;
+	scron->history[index].next_run = next;
+	scron->dirty.entries[index] = true;
+
+	size_t pos = scron->queue.position[index];
+	if (next < old_next)
+		scron_queue_sift_up(scron, pos);
+	else
+		scron_queue_sift_down(scron, pos, scron_get_task_count(scron));
+}
+
+void scron_set_last_run(struct scron *scron, size_t index, time_t last_run)
+{
+	const struct scron_task *task = scron_get_task(scron, index);
+	scron->history[index].last_run = last_run;
+	scron->dirty.entries[index] = true;
+	scron_queue_update(scron, index, scron_schedule_next_time(&task->schedule, last_run));
+	scron_order_move(scron, scron->run_order.rank[index], scron_get_task_count(scron) - 1);
+}
+
+void scron_mark_dirty(struct scron *scron, size_t index)
+{
+	scron->dirty.entries[index] = true;
+}
+
+bool scron_is_dirty(const struct scron *scron, size_t index)
+{
+	return scron->dirty.entries[index];
+}
+
+bool scron_is_layout_dirty(const struct scron *scron)
+{
+	return scron->dirty.layout;
+}
+
+void scron_clear_dirty(struct scron *scron)
+{
+	memset(scron->dirty.entries, 0,
+		sizeof(scron->dirty.entries[0]) * scron_get_task_count(scron));
+	scron->dirty.layout = false;
+}
+
+// Classifies a task without branching, so the scan over every task stays a
+// straight loop. Tasks that never run are SCRON_NEVER, which is never due
+static inline uint8_t scron_classify(time_t now, time_t next, time_t window,
+	uint16_t minimum_voltage, uint32_t voltage)
+{
+	time_t late = now - next;
+	unsigned due = late >= 0;
+	unsigned missed = due & (late >= window);
+	unsigned low = due & !missed & (minimum_voltage > voltage);
+	return due + low + 2 * missed;
+}
+
+size_t scron_scan(struct scron *scron, time_t now, uint32_t voltage)
+{
+	const size_t count = scron_get_task_count(scron);
+	const time_t *next = scron->queue.next;
+	const uint16_t *minimum_voltage = scron->hot.minimum_voltage;
+	const time_t *window = scron->hot.window;
+	uint8_t *state = scron->hot.state;
+	size_t ready = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		state[i] = scron_classify(now, next[i], window[i], minimum_voltage[i], voltage);
+		ready += state[i] != SCRON_SCAN_WAITING;
 	}
+	return ready;
+}
+
+enum scron_scan_state scron_scan_task(struct scron *scron, size_t index,
+	time_t now, uint32_t voltage)
+{
+	scron->hot.state[index] = scron_classify(now, scron->queue.next[index],
+		scron->hot.window[index], scron->hot.minimum_voltage[index], voltage);
+	return scron->hot.state[index];
+}
 
-	return result;
+enum scron_scan_state scron_get_scan_state(const struct scron *scron, size_t index)
+{
+	return scron->hot.state[index];
+}
+
+void scron_reschedule(struct scron *scron, size_t index, time_t now)
+{
+	const struct scron_task *task = scron_get_task(scron, index);
+	// Searching from just before now keeps a run scheduled exactly at now
+	scron_queue_update(scron, index, scron_schedule_next_time(&task->schedule, now - 1));
+}
+
+void scron_invalidate_next_runs(struct scron *scron)
+{
+	const size_t count = scron_get_task_count(scron);
+	for (size_t i = 0; i < count; ++i)
+	{
+		scron->history[i].next_run = 0;
+		scron->dirty.entries[i] = true;
+	}
+	scron_queue_rebuild(scron);
 }
 
 void scron_save(const struct scron *scron, scron_save_callback callback)
@@ -167,7 +991,7 @@ void scron_save(const struct scron *scron, scron_save_callback callback)
 	}
 }
 
-void scron_load(const struct scron *scron, scron_load_callback callback)
+void scron_load(struct scron *scron, scron_load_callback callback)
 {
 	for (size_t i = 0; i < scron->static_tasks.size; ++i)
 	{
@@ -177,14 +1001,25 @@ void scron_load(const struct scron *scron, scron_load_callback callback)
 
 	for (size_t i = 0; i < scron->runtime_tasks.size; ++i)
 	{
-		time_t *last_run = &scron->history[i].last_run;
+		time_t *last_run = &scron->history[i + scron->static_tasks.size].last_run;
 		callback(scron->runtime_tasks.tasks[i].name, last_run);
 	}
+
+	// Only last runs are stored, so every next run is worked out again
+	for (size_t i = 0; i < scron_get_task_count(scron); ++i)
+		scron->history[i].next_run = 0;
+	scron_refresh(scron);
+}
+
+void scron_refresh(struct scron *scron)
+{
+	scron_queue_rebuild(scron);
+	scron_order_rebuild(scron);
 }
 
-struct scron_task *scron_get_task(struct scron *scron, size_t index)
+const struct scron_task *scron_get_task(const struct scron *scron, size_t index)
 {
-	if (index > scron_get_task_count(scron))
+	if (index >= scron_get_task_count(scron))
 		return NULL;
 
 	if (index < scron->static_tasks.size)
@@ -192,19 +1027,27 @@ struct scron_task *scron_get_task(struct scron *scron, size_t index)
 	return &scron->runtime_tasks.tasks[index - scron->static_tasks.size];
 }
 
-struct scron_task *scron_get_task_by_name(struct scron *scron, const char *name)
+size_t scron_find_task(const struct scron *scron, const char *name)
 {
-	for (size_t i = 0; i < scron->static_tasks.size; ++i)
-	{
-		if (!strcmp(name, scron->static_tasks.tasks[i].name))
-			return &scron->static_tasks.tasks[i];
-	}
+	const struct scron_name_index *names = &scron->names;
+	const size_t task_count = scron_get_task_count(scron);
+	if (!names->capacity)
+		return task_count;
 
-	for (size_t i = 0; i < scron->runtime_tasks.size; ++i)
+	const size_t mask = names->capacity - 1;
+	uint32_t hash = scron_hash_name(name);
+	for (size_t slot = hash & mask; names->slots[slot].index != SCRON_NAME_EMPTY;
+			slot = (slot + 1) & mask)
 	{
-		if (!strcmp(name, scron->runtime_tasks.tasks[i].name))
-			return &scron->runtime_tasks.tasks[i];
+		const struct scron_name_slot *entry = &names->slots[slot];
+		if (entry->hash == hash &&
+				!strcmp(name, scron_get_task(scron, entry->index)->name))
+			return entry->index;
 	}
+	return task_count;
+}
 
-	return NULL;
+const struct scron_task *scron_get_task_by_name(const struct scron *scron, const char *name)
+{
+	return scron_get_task(scron, scron_find_task(scron, name));
 }
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <scron_alarm.h>
+#include <scron.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "little_endian.h"
+
+// Longest a month can be without the alarm's day of the month matching again
+#define SHORTEST_MONTH (28 * 86400)
+
+uint32_t scron_alarm_repeat_interval(enum scron_alarm_repeat repeat)
+{
+	switch (repeat)
+	{
+	case SCRON_ALARM_REPEAT_SECOND:
+		return 1;
+	case SCRON_ALARM_REPEAT_MINUTE:
+		return 60;
+	case SCRON_ALARM_REPEAT_HOUR:
+		return 3600;
+	case SCRON_ALARM_REPEAT_DAY:
+		return 86400;
+	case SCRON_ALARM_REPEAT_WEEK:
+		return 7 * 86400;
+	default:
+		return 0;
+	}
+}
+
+struct wake_entry
+{
+	time_t next;
+	size_t index;
+};
+
+static int wake_entry_compare(const void *a, const void *b)
+{
+	const struct wake_entry *a_ = a;
+	const struct wake_entry *b_ = b;
+	if (a_->next != b_->next)
+		return a_->next < b_->next ? -1 : 1;
+	if (a_->index != b_->index)
+		return a_->index < b_->index ? -1 : 1;
+	return 0;
+}
+
+// Whether task a runs before task b, by next run and then by index
+static bool runs_before(const time_t *next, size_t a, size_t b)
+{
+	return next[a] < next[b] || (next[a] == next[b] && a < b);
+}
+
+// Predicts up to count wakes, the same way scron_next_wake coalesces them,
+// running every task due at each. Returns the number of wakes predicted,
+// fewer if the tasks stop running, or 0 if memory ran out
+static size_t predict_wakes(const struct scron *scron,
+	const struct scron_alarm_config *config, time_t now, time_t *wakes,
+	size_t count)
+{
+	const size_t task_count = scron_get_task_count(scron);
+	if (!task_count)
+		return 0;
+	// Sorted once, and after that only the tasks that ran move
+	time_t *next = malloc(sizeof(*next) * task_count);
+	size_t *order = malloc(sizeof(*order) * task_count);
+	struct wake_entry *entries = malloc(sizeof(*entries) * task_count);
+	if (!next || !order || !entries)
+	{
+		free(next);
+		free(order);
+		free(entries);
+		return 0;
+	}
+	for (size_t i = 0; i < task_count; ++i)
+	{
+		entries[i].next = scron_get_next_run(scron, i);
+		entries[i].index = i;
+		next[i] = entries[i].next;
+	}
+	qsort(entries, task_count, sizeof(*entries), wake_entry_compare);
+	for (size_t i = 0; i < task_count; ++i)
+		order[i] = entries[i].index;
+	free(entries);
+
+	size_t predicted = 0;
+	for (; predicted < count; ++predicted)
+	{
+		if (next[order[0]] == SCRON_NEVER)
+			break;
+
+		time_t wake;
+		size_t selected = scron_join_wake(scron, config->tolerance, next, order,
+			task_count, &wake);
+		// Tasks that are already due get retried later, and then anything
+		// else due by then runs along with them
+		if (wake <= now)
+		{
+			wake = now + (config->retry > 0 ? config->retry : 1);
+			while (selected < task_count && next[order[selected]] <= wake)
+				++selected;
+		}
+		wakes[predicted] = wake;
+		now = wake;
+
+		// The tasks that ran are the first ones, and each only moves later
+		for (size_t i = selected; i > 0; --i)
+		{
+			size_t index = order[i - 1];
+			next[index] = scron_schedule_next_time(
+				&scron_get_task(scron, index)->schedule, wake);
+			size_t pos = i - 1;
+			for (; pos + 1 < task_count && runs_before(next, order[pos + 1], index); ++pos)
+				order[pos] = order[pos + 1];
+			order[pos] = index;
+		}
+	}
+	free(next);
+	free(order);
+	return predicted;
+}
+
+// Whether the RTC countdown timer can fire first after first seconds, and
+// then every period seconds
+static bool countdown_fits(time_t first, uint32_t period)
+{
+	if (first <= SCRON_ALARM_COUNTDOWN_MAX && period <= SCRON_ALARM_COUNTDOWN_MAX)
+		return true;
+	return first % 60 == 0 && first / 60 <= SCRON_ALARM_COUNTDOWN_MAX &&
+		period % 60 == 0 && period / 60 <= SCRON_ALARM_COUNTDOWN_MAX;
+}
+
+// Shortest repeat that still fires first at the wake, in case the MCU fails
+// to rearm the alarm
+static enum scron_alarm_repeat fallback_repeat(time_t until_wake)
+{
+	static const enum scron_alarm_repeat repeats[] = {
+		SCRON_ALARM_REPEAT_MINUTE,
+		SCRON_ALARM_REPEAT_HOUR,
+		SCRON_ALARM_REPEAT_DAY,
+		SCRON_ALARM_REPEAT_WEEK,
+	};
+	for (size_t i = 0; i < sizeof(repeats) / sizeof(*repeats); ++i)
+	{
+		if (until_wake <= scron_alarm_repeat_interval(repeats[i]))
+			return repeats[i];
+	}
+	if (until_wake <= SHORTEST_MONTH)
+		return SCRON_ALARM_REPEAT_MONTH;
+	return SCRON_ALARM_REPEAT_YEAR;
+}
+
+bool scron_alarm_plan(const struct scron *scron,
+	const struct scron_alarm_config *config, time_t now,
+	struct scron_alarm_plan *plan)
+{
+	time_t wakes[SCRON_ALARM_LOOKAHEAD];
+	size_t predicted = predict_wakes(scron, config, now, wakes, SCRON_ALARM_LOOKAHEAD);
+	if (!predicted)
+		return false;
+
+	const time_t wake = wakes[0];
+	time_t period = predicted > 1 ? wakes[1] - wakes[0] : 0;
+	for (size_t i = 2; i < predicted && period; ++i)
+	{
+		if (wakes[i] - wakes[i - 1] != period)
+			period = 0;
+	}
+	// Only if all of the lookahead is evenly spaced, and the RTC fires first
+	// at the wake
+	if (predicted < SCRON_ALARM_LOOKAHEAD || period > UINT32_MAX ||
+			wake - now > period)
+		period = 0;
+
+	plan->wake = wake;
+	plan->mode = SCRON_ALARM_MATCH;
+	plan->repeat = fallback_repeat(wake - now);
+	plan->period = 0;
+	if (!period)
+		return true;
+
+	for (enum scron_alarm_repeat repeat = SCRON_ALARM_REPEAT_WEEK;
+			repeat <= SCRON_ALARM_REPEAT_SECOND; ++repeat)
+	{
+		if (scron_alarm_repeat_interval(repeat) == period)
+		{
+			plan->repeat = repeat;
+			plan->period = period;
+			return true;
+		}
+	}
+	if (config->countdown && countdown_fits(wake - now, period))
+	{
+		plan->mode = SCRON_ALARM_COUNTDOWN;
+		plan->repeat = SCRON_ALARM_REPEAT_NONE;
+		plan->period = period;
+	}
+	return true;
+}
+
+// Whether the armed plan fires next after now at wake. A periodic plan keeps
+// firing every period from its wake
+static bool fires_next_at(const struct scron_alarm_plan *armed, time_t wake,
+	time_t now)
+{
+	const time_t period = armed->period;
+	return period && wake > now && wake - now <= period &&
+		(wake - armed->wake) % period == 0;
+}
+
+bool scron_alarm_is_current(const struct scron *scron,
+	const struct scron_alarm_config *config,
+	const struct scron_alarm_plan *armed, time_t now)
+{
+	if (!armed->period)
+		return false;
+	// If more tasks share the wake than fit, the wake comes out early, and
+	// then it is planned as usual
+	size_t tasks[SCRON_ALARM_WAKE_TASKS];
+	time_t wake;
+	if (!scron_next_wake(scron, config->tolerance, &wake, tasks,
+			SCRON_ALARM_WAKE_TASKS))
+		return false;
+	return fires_next_at(armed, wake, now);
+}
+
+void scron_alarm_plan_encode(const struct scron_alarm_plan *plan, void *buffer)
+{
+	uint8_t *data = buffer;
+	put_u32(data, plan->wake);
+	put_u32(data + 4, plan->period);
+	data[8] = plan->repeat | (plan->mode << 3);
+	put_u16(data + 9, scron_crc32(0, data, 9));
+}
+
+bool scron_alarm_plan_decode(struct scron_alarm_plan *plan, const void *buffer)
+{
+	const uint8_t *data = buffer;
+	if (get_u16(data + 9) != (uint16_t)scron_crc32(0, data, 9) || data[8] >> 4)
+		return false;
+	plan->wake = get_u32(data);
+	plan->period = get_u32(data + 4);
+	plan->repeat = data[8] & 0x7;
+	plan->mode = data[8] >> 3;
+	return true;
+}
+
+bool scron_alarm_arm(const struct scron_rtc *rtc,
+	const struct scron_alarm_plan *plan, struct scron_alarm_plan *armed,
+	time_t now)
+{
+	// If the new wake is when the armed plan fires next anyway, there's
+	// nothing to do
+	if (plan->period == armed->period && plan->mode == armed->mode &&
+			plan->repeat == armed->repeat && fires_next_at(armed, plan->wake, now))
+		return true;
+
+	if (plan->mode == SCRON_ALARM_COUNTDOWN)
+	{
+		if (!rtc->write_countdown ||
+				!rtc->write_countdown(rtc->data, plan->wake - now, plan->period) ||
+				!rtc->write_alarm(rtc->data, 0, SCRON_ALARM_REPEAT_NONE))
+			return false;
+	}
+	else
+	{
+		if (!rtc->write_alarm(rtc->data, plan->wake, plan->repeat))
+			return false;
+		// The countdown timer outlives MCU resets, so stop it too if what's
+		// armed is unknown
+		bool countdown_armed = armed->mode == SCRON_ALARM_COUNTDOWN ||
+			armed->repeat == SCRON_ALARM_REPEAT_NONE;
+		if (rtc->write_countdown && countdown_armed &&
+				!rtc->write_countdown(rtc->data, 0, 0))
+			return false;
+	}
+	*armed = *plan;
+	return true;
+}
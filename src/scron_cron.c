@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <scron.h>
+
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// How far ahead to search before giving up. Any valid date comes around on
+// any day of the week within 40 years: the calendar repeats every 28 years,
+// except across a century that skips its leap year, e.g. a Monday February
+// 29th comes in 2072 and then in 2112
+#define SCRON_CRON_MAX_DAYS (366 * 40)
+
+// Days since 1970-01-01 to a proleptic Gregorian calendar date, from Howard
+// Hinnant's date algorithms
+static void civil_from_days(int64_t z, int64_t *year, int *month, int *day)
+{
+	z += 719468;
+	const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	const int64_t doe = z - era * 146097;
+	const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const int64_t mp = (5 * doy + 2) / 153;
+	*day = doy - (153 * mp + 2) / 5 + 1;
+	*month = mp < 10 ? mp + 3 : mp - 9;
+	*year = yoe + era * 400 + (*month <= 2);
+}
+
+// The inverse of civil_from_days
+static int64_t days_from_civil(int64_t year, int month, int day)
+{
+	year -= month <= 2;
+	const int64_t era = (year >= 0 ? year : year - 399) / 400;
+	const int64_t yoe = year - era * 400;
+	const int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static int days_in_month(int64_t year, int month)
+{
+	static const uint8_t days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	if (month == 2 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)))
+		return 29;
+	return days[month - 1];
+}
+
+// Lowest set bit at or above bit, or -1 if there are none
+static int next_bit(uint64_t mask, int bit)
+{
+	if (bit > 63)
+		return -1;
+	mask &= ~(SCRON_CRON_BIT(bit) - 1);
+	if (!mask)
+		return -1;
+	return __builtin_ctzll(mask);
+}
+
+// Bitmask of the days in the month (bit 1 is the 1st) that match the day of
+// the month and day of the week masks
+static uint32_t month_day_mask(const struct scron_cron *cron, int64_t first_day, int length)
+{
+	// 1970-01-01 was a Thursday
+	int weekday = (first_day + 4) % 7;
+	if (weekday < 0)
+		weekday += 7;
+	// Rotate the weekday mask so bit 0 is the weekday of the 1st, then repeat
+	// it for every week in the month
+	uint32_t week = ((cron->weekdays >> weekday) | (cron->weekdays << (7 - weekday))) & 0x7F;
+	uint64_t weekdays = week | (week << 7) | (week << 14) | (week << 21) | ((uint64_t)week << 28);
+	uint32_t by_weekday = (uint32_t)(weekdays << 1);
+
+	uint32_t match;
+	if (cron->flags & SCRON_CRON_DAY_OR)
+		match = cron->days | by_weekday;
+	else
+		match = cron->days & by_weekday;
+	return match & (uint32_t)SCRON_CRON_RANGE(1, length);
+}
+
+time_t scron_cron_next_time(const struct scron_cron *cron, time_t now)
+{
+	if (!cron->seconds || !cron->minutes || !cron->hours || !cron->months ||
+			!(cron->days | cron->weekdays))
+		return SCRON_NEVER;
+
+	const time_t start = now + 1;
+	int64_t days = start / 86400;
+	int64_t second_of_day = start % 86400;
+	if (second_of_day < 0)
+	{
+		second_of_day += 86400;
+		days -= 1;
+	}
+	const int64_t last_day = days + SCRON_CRON_MAX_DAYS;
+
+	while (days <= last_day)
+	{
+		int64_t year;
+		int month, day;
+		civil_from_days(days, &year, &month, &day);
+
+		// Find the month...
+		int next_month = next_bit(cron->months, month);
+		if (next_month != month)
+		{
+			if (next_month < 0)
+			{
+				year += 1;
+				next_month = next_bit(cron->months, 1);
+			}
+			days = days_from_civil(year, next_month, 1);
+			second_of_day = 0;
+			continue;
+		}
+
+		// Then the day...
+		int length = days_in_month(year, month);
+		uint32_t matching_days = month_day_mask(cron, days - (day - 1), length);
+		int next_day = next_bit(matching_days, day);
+		if (next_day != day)
+		{
+			if (next_day < 0)
+				next_day = length + 1;
+			days += next_day - day;
+			second_of_day = 0;
+			continue;
+		}
+
+		// And finally the time of day. Any field that moves forward resets
+		// all of the fields below it
+		int hour = second_of_day / 3600;
+		int minute = (second_of_day / 60) % 60;
+		int second = second_of_day % 60;
+
+		int next_hour = next_bit(cron->hours, hour);
+		if (next_hour < 0)
+		{
+			days += 1;
+			second_of_day = 0;
+			continue;
+		}
+		if (next_hour != hour)
+		{
+			hour = next_hour;
+			minute = 0;
+			second = 0;
+		}
+
+		int next_minute = next_bit(cron->minutes, minute);
+		if (next_minute < 0)
+		{
+			second_of_day = (hour + 1) * 3600;
+			if (second_of_day >= 86400)
+			{
+				days += 1;
+				second_of_day = 0;
+			}
+			continue;
+		}
+		if (next_minute != minute)
+		{
+			minute = next_minute;
+			second = 0;
+		}
+
+		int next_second = next_bit(cron->seconds, second);
+		if (next_second < 0)
+		{
+			second_of_day = hour * 3600 + (minute + 1) * 60;
+			if (second_of_day >= 86400)
+			{
+				days += 1;
+				second_of_day = 0;
+			}
+			continue;
+		}
+
+		return days * 86400 + hour * 3600 + minute * 60 + next_second;
+	}
+	return SCRON_NEVER;
+}
+
+// Parses an unsigned number, advancing the string past it
+static bool parse_number(const char **str, int *value)
+{
+	const char *c = *str;
+	if (*c < '0' || *c > '9')
+		return false;
+	int result = 0;
+	while (*c >= '0' && *c <= '9')
+	{
+		result = result * 10 + (*c - '0');
+		if (result > 1000)
+			return false;
+		++c;
+	}
+	*value = result;
+	*str = c;
+	return true;
+}
+
+// Parses a single cron field into a mask, advancing the string past it
+static bool parse_field(const char **str, int min, int max, uint64_t *mask, bool *star)
+{
+	const char *c = *str;
+	uint64_t result = 0;
+	*star = false;
+	for (;;)
+	{
+		int low, high, step = 1;
+		if (*c == '*')
+		{
+			low = min;
+			high = max;
+			*star = true;
+			++c;
+		}
+		else
+		{
+			if (!parse_number(&c, &low))
+				return false;
+			high = low;
+			if (*c == '-')
+			{
+				++c;
+				if (!parse_number(&c, &high))
+					return false;
+			}
+			else if (*c == '/')
+			{
+				high = max;
+			}
+		}
+
+		if (*c == '/')
+		{
+			++c;
+			if (!parse_number(&c, &step) || step == 0)
+				return false;
+			*star = false;
+		}
+
+		if (low < min || high > max || low > high)
+			return false;
+		for (int i = low; i <= high; i += step)
+			result |= SCRON_CRON_BIT(i);
+
+		if (*c != ',')
+			break;
+		++c;
+	}
+
+	if (*c != '\0' && *c != ' ' && *c != '\t')
+		return false;
+	*mask = result;
+	*str = c;
+	return true;
+}
+
+bool scron_cron_parse(struct scron_cron *cron, const char *expression)
+{
+	static const int limits[6][2] = {
+		{ 0, 59 }, // second
+		{ 0, 59 }, // minute
+		{ 0, 23 }, // hour
+		{ 1, 31 }, // day of the month
+		{ 1, 12 }, // month
+		{ 0, 7 }, // day of the week, 7 being Sunday again
+	};
+	uint64_t masks[6];
+	bool stars[6];
+
+	const char *c = expression;
+	for (size_t i = 0; i < 6; ++i)
+	{
+		while (*c == ' ' || *c == '\t')
+			++c;
+		if (!parse_field(&c, limits[i][0], limits[i][1], &masks[i], &stars[i]))
+			return false;
+	}
+	while (*c == ' ' || *c == '\t')
+		++c;
+	if (*c != '\0')
+		return false;
+
+	// Fold Sunday as 7 into Sunday as 0
+	if (masks[5] & SCRON_CRON_BIT(7))
+		masks[5] = (masks[5] | SCRON_CRON_BIT(0)) & ~SCRON_CRON_BIT(7);
+
+	cron->seconds = masks[0];
+	cron->minutes = masks[1];
+	cron->hours = masks[2];
+	cron->days = masks[3];
+	cron->months = masks[4];
+	cron->weekdays = masks[5];
+	cron->flags = 0;
+	// Like cron, if both day fields are restricted, either can match
+	if (!stars[3] && !stars[5])
+		cron->flags |= SCRON_CRON_DAY_OR;
+	return true;
+}
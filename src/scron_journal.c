@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <scron_journal.h>
+#include <scron.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "little_endian.h"
+
+#define JOURNAL_HEADER_SIZE 8
+#define JOURNAL_FOOTER_SIZE 12
+
+// Builds a whole record, header to footer, in a newly allocated buffer. Full
+// records have the history of every task, and the rest only what's dirty
+static uint8_t *journal_record(const struct scron *scron, bool full, size_t *size)
+{
+	size_t payload_size = full ? scron_serialized_size(scron) : scron_serialized_dirty_size(scron);
+	*size = JOURNAL_HEADER_SIZE + payload_size + JOURNAL_FOOTER_SIZE;
+	uint8_t *record = malloc(*size);
+	if (!record)
+		return NULL;
+
+	put_u32(record, full ? SCRON_JOURNAL_MAGIC : SCRON_JOURNAL_DELTA_MAGIC);
+	put_u32(record + 4, payload_size);
+	if (full)
+		scron_serialize(scron, record + JOURNAL_HEADER_SIZE, payload_size);
+	else
+		scron_serialize_dirty(scron, record + JOURNAL_HEADER_SIZE, payload_size);
+
+	uint8_t *footer = record + JOURNAL_HEADER_SIZE + payload_size;
+	put_u32(footer, payload_size);
+	put_u32(footer + 4, scron_crc32(0, record, JOURNAL_HEADER_SIZE + payload_size));
+	put_u32(footer + 8, SCRON_JOURNAL_MAGIC);
+	return record;
+}
+
+// Rewrites the journal with only the given record
+static void journal_compact(const struct scron_journal *journal,
+	const uint8_t *record, size_t size)
+{
+	FILE *file = fopen(journal->temporary_path, "wb");
+	if (!file)
+		return;
+	bool written = fwrite(record, size, 1, file) == 1;
+	if (fclose(file) || !written)
+	{
+		remove(journal->temporary_path);
+		return;
+	}
+	// If power is lost between these two, load finishes the rename
+	remove(journal->path);
+	rename(journal->temporary_path, journal->path);
+}
+
+bool scron_journal_save(const struct scron_journal *journal, const struct scron *scron,
+	bool full)
+{
+	// Moved entries can only be captured by saving everything
+	full = full || scron_is_layout_dirty(scron);
+	if (!full && scron_serialized_dirty_size(scron) == SCRON_SNAPSHOT_HEADER_SIZE)
+		return true;
+
+	size_t size;
+	uint8_t *record = journal_record(scron, full, &size);
+	if (!record)
+		return false;
+
+	FILE *file = fopen(journal->path, "ab");
+	if (!file)
+	{
+		free(record);
+		return false;
+	}
+	bool written = fwrite(record, size, 1, file) == 1;
+	long journal_size = ftell(file);
+	if (fclose(file) || !written)
+	{
+		free(record);
+		return false;
+	}
+
+	if (journal->compact_size && journal_size > 0 &&
+			(size_t)journal_size > journal->compact_size)
+	{
+		// The compacted journal needs a full record to start from
+		if (!full)
+		{
+			free(record);
+			record = journal_record(scron, true, &size);
+		}
+		if (record)
+			journal_compact(journal, record, size);
+	}
+	free(record);
+	return true;
+}
+
+// Reads the record ending at end, and checks it. On success, the record is
+// returned in a newly allocated buffer. Either way, end is moved back to where
+// the search for the previous record should continue
+static uint8_t *journal_read_record(FILE *file, long *end, bool *full)
+{
+	uint8_t footer[JOURNAL_FOOTER_SIZE];
+	if (fseek(file, *end - JOURNAL_FOOTER_SIZE, SEEK_SET) ||
+			fread(footer, sizeof(footer), 1, file) != 1 ||
+			get_u32(footer + 8) != SCRON_JOURNAL_MAGIC)
+	{
+		// Not the end of a record, likely a torn write. Keep looking one byte
+		// at a time, this is only slow for the part of the file that's bad
+		*end -= 1;
+		return NULL;
+	}
+
+	uint32_t payload_size = get_u32(footer);
+	long record_size = JOURNAL_HEADER_SIZE + (long)payload_size;
+	if (payload_size > (uint32_t)*end || record_size > *end - JOURNAL_FOOTER_SIZE)
+	{
+		*end -= 1;
+		return NULL;
+	}
+
+	long start = *end - JOURNAL_FOOTER_SIZE - record_size;
+	uint8_t *record = malloc(record_size);
+	if (!record)
+		return NULL;
+	uint32_t magic;
+	if (fseek(file, start, SEEK_SET) ||
+			fread(record, record_size, 1, file) != 1 ||
+			get_u32(record + 4) != payload_size ||
+			scron_crc32(0, record, record_size) != get_u32(footer + 4) ||
+			((magic = get_u32(record)) != SCRON_JOURNAL_MAGIC &&
+				magic != SCRON_JOURNAL_DELTA_MAGIC))
+	{
+		// The size in the footer can't be trusted either, and jumping by it
+		// could skip good records, so keep looking one byte at a time
+		free(record);
+		*end -= 1;
+		return NULL;
+	}
+	// Only a good record tells where the previous one ends
+	*end = start;
+	*full = magic == SCRON_JOURNAL_MAGIC;
+	return record;
+}
+
+// Applies the history of the tasks in a record that no newer record had
+static bool journal_apply(struct scron *scron, const uint8_t *record, bool *seen)
+{
+	struct scron_snapshot snapshot;
+	if (!scron_snapshot_open(&snapshot, record + JOURNAL_HEADER_SIZE,
+			get_u32(record + 4)))
+		return false;
+
+	const size_t task_count = scron_get_task_count(scron);
+	for (size_t i = 0; i < snapshot.count; ++i)
+	{
+		size_t index = scron_find_task(scron, scron_snapshot_name(&snapshot, i));
+		if (index != task_count && !seen[index])
+		{
+			scron_snapshot_restore(&snapshot, i, scron, index);
+			seen[index] = true;
+		}
+	}
+	return true;
+}
+
+bool scron_journal_load(const struct scron_journal *journal, struct scron *scron)
+{
+	// A compaction interrupted between removing the journal and renaming the
+	// temporary file over it leaves only the temporary file. Finish it, else
+	// the next save would start a new journal with a delta and no full record
+	// before it, and the history in the temporary file would be lost
+	FILE *file = fopen(journal->path, "rb");
+	if (!file && !rename(journal->temporary_path, journal->path))
+		file = fopen(journal->path, "rb");
+	if (!file)
+		file = fopen(journal->temporary_path, "rb");
+	if (!file)
+		return false;
+
+	// Which tasks already got their history from a newer record
+	bool *seen = calloc(scron_get_task_count(scron) + 1, sizeof(*seen));
+	if (!seen)
+	{
+		fclose(file);
+		return false;
+	}
+
+	bool loaded = false;
+	long end = -1;
+	if (!fseek(file, 0, SEEK_END))
+		end = ftell(file);
+	// Walk back through the deltas until the newest full record. The search is
+	// bounded by the start of the file
+	while (end >= JOURNAL_HEADER_SIZE + JOURNAL_FOOTER_SIZE)
+	{
+		long previous_end = end;
+		bool full;
+		uint8_t *record = journal_read_record(file, &end, &full);
+		if (!record)
+		{
+			// Out of memory, no point in looking further
+			if (end == previous_end)
+				break;
+			continue;
+		}
+		bool applied = journal_apply(scron, record, seen);
+		free(record);
+		loaded = loaded || applied;
+		if (applied && full)
+			break;
+	}
+	fclose(file);
+	free(seen);
+
+	if (loaded)
+		scron_refresh(scron);
+	return loaded;
+}
@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <scron.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "little_endian.h"
+
+#define SNAPSHOT_HEADER_SIZE SCRON_SNAPSHOT_HEADER_SIZE
+#define SNAPSHOT_ENTRY_SIZE SCRON_SNAPSHOT_ENTRY_SIZE
+#define SNAPSHOT_STATS_ENTRY_SIZE SCRON_SNAPSHOT_STATS_ENTRY_SIZE
+// Offsets of the fields of entries
+#define SNAPSHOT_NAME_OFFSET 12
+#define SNAPSHOT_NEXT_RUN_OFFSET 16
+#define SNAPSHOT_FINGERPRINT_OFFSET 20
+#define SNAPSHOT_STATS_OFFSET 22
+
+uint32_t scron_crc32(uint32_t crc, const void *data, size_t size)
+{
+	// Nibble at a time, trading some speed for a table that fits in 64 bytes
+	static const uint32_t table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+		0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+		0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+	};
+	const uint8_t *byte = data;
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc = (crc >> 4) ^ table[(crc ^ byte[i]) & 0xF];
+		crc = (crc >> 4) ^ table[(crc ^ (byte[i] >> 4)) & 0xF];
+	}
+	return ~crc;
+}
+
+static size_t name_length(const char *name)
+{
+	size_t length = 0;
+	while (length < sizeof(((struct scron_task*)NULL)->name) && name[length])
+		++length;
+	return length;
+}
+
+// CRC of the whole snapshot, skipping the CRC itself at the end of the header
+static uint32_t snapshot_crc(const uint8_t *data, size_t size)
+{
+	uint32_t crc = scron_crc32(0, data, SNAPSHOT_HEADER_SIZE - 4);
+	return scron_crc32(crc, data + SNAPSHOT_HEADER_SIZE, size - SNAPSHOT_HEADER_SIZE);
+}
+
+uint16_t scron_schedule_fingerprint(const struct scron_schedule *sched)
+{
+	// Field by field, so padding and the host's byte order don't matter
+	uint8_t buffer[39];
+	buffer[0] = sched->hour;
+	buffer[1] = sched->minute;
+	buffer[2] = sched->second;
+	put_u64(buffer + 3, sched->cron.seconds);
+	put_u64(buffer + 11, sched->cron.minutes);
+	put_u32(buffer + 19, sched->cron.hours);
+	put_u32(buffer + 23, sched->cron.days);
+	put_u16(buffer + 27, sched->cron.months);
+	buffer[29] = sched->cron.weekdays;
+	buffer[30] = sched->cron.flags;
+	put_u32(buffer + 31, sched->period);
+	put_u32(buffer + 35, sched->phase);
+	uint32_t crc = scron_crc32(0, buffer, sizeof(buffer));
+	return crc ^ (crc >> 16);
+}
+
+static void put_stats(uint8_t *buffer, const struct scron_task_stats *stats)
+{
+	put_u32(buffer, stats->runs);
+	buffer += 4;
+	for (size_t i = 0; i < SCRON_LATENESS_BUCKETS; ++i, buffer += 2)
+		put_u16(buffer, stats->lateness[i]);
+	put_u16(buffer, stats->duration_min);
+	put_u16(buffer + 2, stats->duration_max);
+	put_u32(buffer + 4, stats->duration_total);
+	put_u16(buffer + 8, stats->voltage_min);
+	put_u16(buffer + 10, stats->voltage_average);
+	put_u32(buffer + 12, stats->voltage_skips);
+	put_u32(buffer + 16, stats->missed);
+}
+
+static void get_stats(const uint8_t *buffer, struct scron_task_stats *stats)
+{
+	stats->runs = get_u32(buffer);
+	buffer += 4;
+	for (size_t i = 0; i < SCRON_LATENESS_BUCKETS; ++i, buffer += 2)
+		stats->lateness[i] = get_u16(buffer);
+	stats->duration_min = get_u16(buffer);
+	stats->duration_max = get_u16(buffer + 2);
+	stats->duration_total = get_u32(buffer + 4);
+	stats->voltage_min = get_u16(buffer + 8);
+	stats->voltage_average = get_u16(buffer + 10);
+	stats->voltage_skips = get_u32(buffer + 12);
+	stats->missed = get_u32(buffer + 16);
+}
+
+size_t scron_serialized_entry_size(const struct scron *scron)
+{
+	return scron->stats ? SNAPSHOT_STATS_ENTRY_SIZE : SNAPSHOT_ENTRY_SIZE;
+}
+
+// Size of a snapshot of every task, or with dirty_only, of only the tasks
+// whose history is dirty
+static size_t snapshot_size(const struct scron *scron, bool dirty_only)
+{
+	const size_t count = scron_get_task_count(scron);
+	const size_t entry_size = scron_serialized_entry_size(scron);
+	size_t size = SNAPSHOT_HEADER_SIZE;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (dirty_only && !scron_is_dirty(scron, i))
+			continue;
+		size += entry_size + name_length(scron_get_task(scron, i)->name) + 1;
+	}
+	return size;
+}
+
+static size_t serialize(const struct scron *scron, void *buffer, size_t size,
+	bool dirty_only)
+{
+	const size_t total = snapshot_size(scron, dirty_only);
+	// The task count in the header is 16 bits
+	if (size < total || scron_get_task_count(scron) > UINT16_MAX)
+		return 0;
+
+	const size_t task_count = scron_get_task_count(scron);
+	size_t count = task_count;
+	if (dirty_only)
+	{
+		count = 0;
+		for (size_t i = 0; i < task_count; ++i)
+			count += scron_is_dirty(scron, i);
+	}
+
+	const size_t entry_size = scron_serialized_entry_size(scron);
+	uint8_t *data = buffer;
+	uint8_t *entry = data + SNAPSHOT_HEADER_SIZE;
+	uint8_t *names = entry + count * entry_size;
+	uint32_t name_offset = 0;
+	for (size_t i = 0; i < task_count; ++i)
+	{
+		if (dirty_only && !scron_is_dirty(scron, i))
+			continue;
+		const char *name = scron_get_task(scron, i)->name;
+		size_t length = name_length(name);
+		memcpy(names + name_offset, name, length);
+		names[name_offset + length] = '\0';
+
+		const struct scron_task_history *history = &scron->history[i];
+		put_u64(entry, history->last_run);
+		put_u32(entry + 8, history->energy);
+		put_u32(entry + SNAPSHOT_NAME_OFFSET, name_offset);
+		// Next runs that can't be stored as an offset are worked out again
+		time_t next_offset = history->next_run - history->last_run;
+		if (next_offset < 0 || next_offset > (time_t)UINT32_MAX)
+			next_offset = 0;
+		put_u32(entry + SNAPSHOT_NEXT_RUN_OFFSET, next_offset);
+		put_u16(entry + SNAPSHOT_FINGERPRINT_OFFSET,
+			scron_schedule_fingerprint(&scron_get_task(scron, i)->schedule));
+		if (scron->stats)
+			put_stats(entry + SNAPSHOT_STATS_OFFSET, &scron->stats[i]);
+		entry += entry_size;
+		name_offset += length + 1;
+	}
+
+	put_u32(data, SCRON_SNAPSHOT_MAGIC);
+	put_u16(data + 4, SCRON_SNAPSHOT_VERSION);
+	put_u16(data + 6, entry_size);
+	put_u16(data + 8, count);
+	put_u16(data + 10, scron->stats ? SCRON_SNAPSHOT_STATS : 0);
+	put_u32(data + 12, total);
+	put_u32(data + 16, snapshot_crc(data, total));
+	return total;
+}
+
+size_t scron_serialized_size(const struct scron *scron)
+{
+	return snapshot_size(scron, false);
+}
+
+size_t scron_serialize(const struct scron *scron, void *buffer, size_t size)
+{
+	return serialize(scron, buffer, size, false);
+}
+
+size_t scron_serialized_dirty_size(const struct scron *scron)
+{
+	return snapshot_size(scron, true);
+}
+
+size_t scron_serialize_dirty(const struct scron *scron, void *buffer, size_t size)
+{
+	return serialize(scron, buffer, size, true);
+}
+
+bool scron_snapshot_open(struct scron_snapshot *snapshot, const void *buffer, size_t size)
+{
+	const uint8_t *data = buffer;
+	if (size < SNAPSHOT_HEADER_SIZE || get_u32(data) != SCRON_SNAPSHOT_MAGIC)
+		return false;
+
+	// Newer versions only add to the end of entries, which we can skip
+	uint16_t version = get_u16(data + 4);
+	uint16_t entry_size = get_u16(data + 6);
+	uint16_t count = get_u16(data + 8);
+	uint16_t flags = get_u16(data + 10);
+	uint32_t snapshot_size = get_u32(data + 12);
+	size_t min_entry_size = flags & SCRON_SNAPSHOT_STATS ?
+		SNAPSHOT_STATS_ENTRY_SIZE : SNAPSHOT_ENTRY_SIZE;
+	if (version < 1 || entry_size < min_entry_size)
+		return false;
+	// The buffer may be larger than the snapshot in it
+	if (snapshot_size < SNAPSHOT_HEADER_SIZE || snapshot_size > size)
+		return false;
+	size = snapshot_size;
+	size_t available = size - SNAPSHOT_HEADER_SIZE;
+	if (count > available / entry_size)
+		return false;
+	size_t names_size = available - (size_t)count * entry_size;
+	if (count && (!names_size || data[size - 1] != '\0'))
+		return false;
+	if (snapshot_crc(data, size) != get_u32(data + 16))
+		return false;
+
+	// With the name table ending in a terminator, every name in it is
+	// terminated too, so only the offsets need checking
+	const uint8_t *entry = data + SNAPSHOT_HEADER_SIZE;
+	for (size_t i = 0; i < count; ++i, entry += entry_size)
+	{
+		if (get_u32(entry + SNAPSHOT_NAME_OFFSET) >= names_size)
+			return false;
+	}
+
+	snapshot->data = data;
+	snapshot->size = size;
+	snapshot->count = count;
+	snapshot->entry_size = entry_size;
+	snapshot->version = version;
+	snapshot->flags = flags;
+	return true;
+}
+
+size_t scron_snapshot_size(const void *header)
+{
+	const uint8_t *data = header;
+	if (get_u32(data) != SCRON_SNAPSHOT_MAGIC)
+		return 0;
+	return get_u32(data + 12);
+}
+
+// Start of an entry in a snapshot
+static const uint8_t *snapshot_entry(const struct scron_snapshot *snapshot, size_t index)
+{
+	return snapshot->data + SNAPSHOT_HEADER_SIZE + index * snapshot->entry_size;
+}
+
+const char *scron_snapshot_name(const struct scron_snapshot *snapshot, size_t index)
+{
+	const uint8_t *names = snapshot_entry(snapshot, snapshot->count);
+	return (const char *)names + get_u32(snapshot_entry(snapshot, index) + SNAPSHOT_NAME_OFFSET);
+}
+
+void scron_snapshot_history(const struct scron_snapshot *snapshot, size_t index,
+	struct scron_task_history *history)
+{
+	const uint8_t *entry = snapshot_entry(snapshot, index);
+	history->last_run = (time_t)get_u64(entry);
+	history->energy = get_u32(entry + 8);
+	// Without a next run, it is worked out again from the last run
+	uint32_t next_offset = get_u32(entry + SNAPSHOT_NEXT_RUN_OFFSET);
+	history->next_run = next_offset ? history->last_run + next_offset : 0;
+}
+
+bool scron_snapshot_schedule_matches(const struct scron_snapshot *snapshot,
+	size_t index, const struct scron_schedule *sched)
+{
+	const uint8_t *entry = snapshot_entry(snapshot, index);
+	return get_u16(entry + SNAPSHOT_FINGERPRINT_OFFSET) ==
+		scron_schedule_fingerprint(sched);
+}
+
+bool scron_snapshot_stats(const struct scron_snapshot *snapshot, size_t index,
+	struct scron_task_stats *stats)
+{
+	if (!(snapshot->flags & SCRON_SNAPSHOT_STATS))
+		return false;
+	const uint8_t *entry = snapshot_entry(snapshot, index);
+	get_stats(entry + SNAPSHOT_STATS_OFFSET, stats);
+	return true;
+}
+
+void scron_snapshot_restore(const struct scron_snapshot *snapshot, size_t entry,
+	struct scron *scron, size_t index)
+{
+	struct scron_task_history *history = &scron->history[index];
+	scron_snapshot_history(snapshot, entry, history);
+	if (!scron_snapshot_schedule_matches(snapshot, entry,
+			&scron_get_task(scron, index)->schedule))
+		history->next_run = 0;
+	if (scron->stats)
+		scron_snapshot_stats(snapshot, entry, &scron->stats[index]);
+}
+
+bool scron_deserialize(struct scron *scron, const void *buffer, size_t size)
+{
+	struct scron_snapshot snapshot;
+	if (!scron_snapshot_open(&snapshot, buffer, size))
+		return false;
+
+	const size_t task_count = scron_get_task_count(scron);
+	for (size_t i = 0; i < snapshot.count; ++i)
+	{
+		size_t index = scron_find_task(scron, scron_snapshot_name(&snapshot, i));
+		if (index != task_count)
+			scron_snapshot_restore(&snapshot, i, scron, index);
+	}
+	scron_refresh(scron);
+	return true;
+}
@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+#include <scron_storage.h>
+#include <scron_journal.h>
+#include <scron.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "little_endian.h"
+
+#define RTC_RAM_HEADER_SIZE SCRON_RTC_RAM_HEADER_SIZE
+
+bool scron_storage_save(const struct scron_storage *storage, struct scron *scron)
+{
+	if (!storage->save(storage->data, scron, false))
+		return false;
+	scron_clear_dirty(scron);
+	return true;
+}
+
+bool scron_storage_load(const struct scron_storage *storage, struct scron *scron)
+{
+	if (!storage->load(storage->data, scron))
+		return false;
+	scron_clear_dirty(scron);
+	return true;
+}
+
+static bool journal_save(void *data, const struct scron *scron, bool full)
+{
+	return scron_journal_save(data, scron, full);
+}
+
+static bool journal_load(void *data, struct scron *scron)
+{
+	return scron_journal_load(data, scron);
+}
+
+void scron_storage_init_journal(struct scron_storage *storage,
+	const struct scron_journal *journal)
+{
+	storage->save = journal_save;
+	storage->load = journal_load;
+	// The journal is never modified through the backend
+	storage->data = (void *)journal;
+}
+
+static bool memory_save(void *data, const struct scron *scron, bool full)
+{
+	// Always saves everything, there's no cost to it in memory
+	(void)full;
+	struct scron_memory_storage *memory = data;
+	size_t size = scron_serialize(scron, memory->buffer, memory->capacity);
+	if (!size)
+		return false;
+	memory->size = size;
+	return true;
+}
+
+static bool memory_load(void *data, struct scron *scron)
+{
+	struct scron_memory_storage *memory = data;
+	if (!memory->size)
+		return false;
+	return scron_deserialize(scron, memory->buffer, memory->size);
+}
+
+void scron_storage_init_memory(struct scron_storage *storage,
+	struct scron_memory_storage *memory)
+{
+	memory->size = 0;
+	storage->save = memory_save;
+	storage->load = memory_load;
+	storage->data = memory;
+}
+
+// Writes only the header and the dirty entries of the snapshot in buffer
+static bool rtc_ram_write_dirty(struct scron_rtc_ram_storage *rtc_ram,
+	const struct scron *scron, const uint8_t *buffer)
+{
+	const size_t header_size = RTC_RAM_HEADER_SIZE + SCRON_SNAPSHOT_HEADER_SIZE;
+	if (!rtc_ram->write(rtc_ram->data, 0, buffer, header_size))
+		return false;
+	const size_t count = scron_get_task_count(scron);
+	const size_t entry_size = scron_serialized_entry_size(scron);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!scron_is_dirty(scron, i))
+			continue;
+		size_t offset = header_size + i * entry_size;
+		if (!rtc_ram->write(rtc_ram->data, offset, buffer + offset, entry_size))
+			return false;
+	}
+	return true;
+}
+
+// Clears the snapshot magic in the RAM, so a snapshot that could not be
+// replaced is never loaded over the newer history in the fallback
+static void rtc_ram_invalidate(struct scron_rtc_ram_storage *rtc_ram)
+{
+	uint8_t header[RTC_RAM_HEADER_SIZE + 4];
+	put_u32(header, rtc_ram->count);
+	put_u32(header + RTC_RAM_HEADER_SIZE, 0);
+	rtc_ram->write(rtc_ram->data, 0, header, sizeof(header));
+}
+
+static bool rtc_ram_save(void *data, const struct scron *scron, bool full)
+{
+	struct scron_rtc_ram_storage *rtc_ram = data;
+	rtc_ram->count += 1;
+
+	bool saved = false;
+	size_t size = RTC_RAM_HEADER_SIZE + scron_serialized_size(scron);
+	rtc_ram->too_large = size > rtc_ram->size;
+	if (!rtc_ram->too_large)
+	{
+		uint8_t *buffer = malloc(size);
+		if (buffer)
+		{
+			put_u32(buffer, rtc_ram->count);
+			scron_serialize(scron, buffer + RTC_RAM_HEADER_SIZE, size - RTC_RAM_HEADER_SIZE);
+			// The entries are in task order, so if the RAM has the same tasks,
+			// everything but the dirty entries is already there
+			if (!full && rtc_ram->synced_size == size && !scron_is_layout_dirty(scron))
+				saved = rtc_ram_write_dirty(rtc_ram, scron, buffer);
+			else
+				saved = rtc_ram->write(rtc_ram->data, 0, buffer, size);
+			free(buffer);
+		}
+	}
+	if (!saved && rtc_ram->size >= RTC_RAM_HEADER_SIZE + 4)
+		rtc_ram_invalidate(rtc_ram);
+	rtc_ram->synced_size = saved ? size : 0;
+
+	// The fallback has none of the saves the RAM got since it was last
+	// written, so it gets everything unless it got every save since
+	const struct scron_storage *fallback = rtc_ram->fallback;
+	if (!fallback)
+		return saved;
+	if (!saved || (rtc_ram->fallback_interval &&
+			rtc_ram->count % rtc_ram->fallback_interval == 0))
+	{
+		bool fallback_saved = fallback->save(fallback->data, scron,
+			full || !rtc_ram->fallback_synced);
+		rtc_ram->fallback_synced = fallback_saved;
+		saved = saved || fallback_saved;
+	}
+	else
+	{
+		rtc_ram->fallback_synced = false;
+	}
+	return saved;
+}
+
+// Whether the RAM holds exactly what scron would save, right after loading
+// it. Loading restores every entry as it is, except for next runs the task
+// queue had to work out again, e.g. because the schedule changed
+static bool rtc_ram_synced(const struct scron *scron,
+	const struct scron_snapshot *snapshot)
+{
+	const size_t count = scron_get_task_count(scron);
+	if (snapshot->version != SCRON_SNAPSHOT_VERSION || snapshot->count != count ||
+			snapshot->entry_size != scron_serialized_entry_size(scron) ||
+			snapshot->size != scron_serialized_size(scron))
+		return false;
+	for (size_t i = 0; i < count; ++i)
+	{
+		struct scron_task_history history;
+		scron_snapshot_history(snapshot, i, &history);
+		const struct scron_task *task = scron_get_task(scron, i);
+		if (history.next_run != scron->history[i].next_run ||
+				!scron_snapshot_schedule_matches(snapshot, i, &task->schedule) ||
+				strncmp(scron_snapshot_name(snapshot, i), task->name, sizeof(task->name)))
+			return false;
+	}
+	return true;
+}
+
+// Reads the snapshot in the RAM, returning it in a newly allocated buffer
+// after the save counter. Only the header is read before the snapshot size
+// is known, as the RAM is slow to read
+static uint8_t *rtc_ram_read_snapshot(struct scron_rtc_ram_storage *rtc_ram, size_t *size)
+{
+	const size_t header_size = RTC_RAM_HEADER_SIZE + SCRON_SNAPSHOT_HEADER_SIZE;
+	uint8_t header[RTC_RAM_HEADER_SIZE + SCRON_SNAPSHOT_HEADER_SIZE];
+	if (rtc_ram->size < header_size ||
+			!rtc_ram->read(rtc_ram->data, 0, header, header_size))
+		return NULL;
+	*size = RTC_RAM_HEADER_SIZE + scron_snapshot_size(header + RTC_RAM_HEADER_SIZE);
+	if (*size < header_size || *size > rtc_ram->size)
+		return NULL;
+
+	uint8_t *buffer = malloc(*size);
+	if (!buffer)
+		return NULL;
+	memcpy(buffer, header, header_size);
+	if (!rtc_ram->read(rtc_ram->data, header_size, buffer + header_size,
+			*size - header_size))
+	{
+		free(buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+static bool rtc_ram_load(void *data, struct scron *scron)
+{
+	struct scron_rtc_ram_storage *rtc_ram = data;
+	rtc_ram->synced_size = 0;
+	size_t size;
+	uint8_t *buffer = rtc_ram_read_snapshot(rtc_ram, &size);
+	struct scron_snapshot snapshot;
+	bool loaded = buffer &&
+		scron_snapshot_open(&snapshot, buffer + RTC_RAM_HEADER_SIZE,
+			size - RTC_RAM_HEADER_SIZE);
+	if (loaded)
+	{
+		// Restore from the view that was just checked, instead of checking
+		// the snapshot all over again with scron_deserialize
+		const size_t task_count = scron_get_task_count(scron);
+		for (size_t i = 0; i < snapshot.count; ++i)
+		{
+			size_t index = scron_find_task(scron, scron_snapshot_name(&snapshot, i));
+			if (index != task_count)
+				scron_snapshot_restore(&snapshot, i, scron, index);
+		}
+		scron_refresh(scron);
+		rtc_ram->count = get_u32(buffer);
+		if (rtc_ram_synced(scron, &snapshot))
+			rtc_ram->synced_size = size;
+	}
+	free(buffer);
+	rtc_ram->fallback_synced = false;
+	if (loaded)
+		return true;
+
+	// The RAM lost its contents, or its snapshot could not be replaced by a
+	// newer one, so restart the count such that the next
+	// save wraps around to 0, which also goes to the fallback if it's written
+	// at an interval
+	rtc_ram->count = UINT32_MAX;
+	if (!rtc_ram->fallback)
+		return false;
+	rtc_ram->fallback_synced = scron_storage_load(rtc_ram->fallback, scron);
+	return rtc_ram->fallback_synced;
+}
+
+void scron_storage_init_rtc_ram(struct scron_storage *storage,
+	struct scron_rtc_ram_storage *rtc_ram)
+{
+	rtc_ram->count = 0;
+	rtc_ram->synced_size = 0;
+	rtc_ram->fallback_synced = false;
+	rtc_ram->too_large = false;
+	storage->save = rtc_ram_save;
+	storage->load = rtc_ram_load;
+	storage->data = rtc_ram;
+}
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Host test for the alarm planner, with the RTC mocked by a struct that counts
+// how often it is written to.
+
+#include <scron.h>
+#include <scron_alarm.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
+
+static int failures;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *expression, int line)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "line %d: check failed: %s\n", line, expression);
+		++failures;
+	}
+}
+
+// Mock RTC, which remembers what it was last armed with
+struct mock_rtc
+{
+	size_t writes;
+	time_t alarm;
+	enum scron_alarm_repeat repeat;
+	uint32_t first;
+	uint32_t period;
+};
+
+static bool mock_write_alarm(void *data, time_t time, enum scron_alarm_repeat repeat)
+{
+	struct mock_rtc *rtc = data;
+	++rtc->writes;
+	rtc->alarm = time;
+	rtc->repeat = repeat;
+	return true;
+}
+
+static bool mock_write_countdown(void *data, uint32_t first, uint32_t period)
+{
+	struct mock_rtc *rtc = data;
+	++rtc->writes;
+	rtc->first = first;
+	rtc->period = period;
+	return true;
+}
+
+static struct mock_rtc mock;
+static const struct scron_rtc rtc = {
+	.write_alarm = mock_write_alarm,
+	.write_countdown = mock_write_countdown,
+	.data = &mock,
+};
+
+static int task(void *data)
+{
+	(void)data;
+	return 0;
+}
+
+// Midnight, 2023-01-01 UTC
+#define START 1672531200
+
+// Tasks at :10, :20, :30, :40 and :50 every minute, like the firmware's
+static struct scron_task cron_tasks[5];
+
+static void init_cron(struct scron *scron)
+{
+	static const char *const schedules[] = {
+		"10 * * * * *", "20 * * * * *", "30 * * * * *", "40 * * * * *",
+		"50 * * * * *",
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(cron_tasks); ++i)
+	{
+		memset(&cron_tasks[i], 0, sizeof(cron_tasks[i]));
+		snprintf(cron_tasks[i].name, sizeof(cron_tasks[i].name), "task%zu", i);
+		cron_tasks[i].function = task;
+		cron_tasks[i].schedule.hour = -1;
+		cron_tasks[i].schedule.minute = -1;
+		cron_tasks[i].schedule.second = -1;
+		if (!scron_cron_parse(&cron_tasks[i].schedule.cron, schedules[i]))
+			exit(1);
+	}
+	static const struct scron_tasks table = { ARRAY_SIZE(cron_tasks), cron_tasks };
+	if (!scron_init(scron, &table))
+		exit(1);
+	for (size_t i = 0; i < ARRAY_SIZE(cron_tasks); ++i)
+		scron_set_last_run(scron, i, START);
+}
+
+// With enough tolerance every task shares the wake at :50, and the alarm
+// repeats it every minute without being written to again
+static void test_periodic(void)
+{
+	struct scron scron;
+	init_cron(&scron);
+	const struct scron_alarm_config config = { .tolerance = 40, .retry = 10 };
+
+	struct scron_alarm_plan plan;
+	CHECK(scron_alarm_plan(&scron, &config, START, &plan));
+	CHECK(plan.mode == SCRON_ALARM_MATCH);
+	CHECK(plan.wake == START + 50);
+	CHECK(plan.repeat == SCRON_ALARM_REPEAT_MINUTE);
+	CHECK(plan.period == 60);
+
+	struct scron_alarm_plan armed = {0};
+	CHECK(!scron_alarm_is_current(&scron, &config, &armed, START));
+	mock.writes = 0;
+	CHECK(scron_alarm_arm(&rtc, &plan, &armed, START));
+	CHECK(mock.alarm == START + 50);
+	CHECK(mock.repeat == SCRON_ALARM_REPEAT_MINUTE);
+	size_t writes = mock.writes;
+
+	// What the MCU remembers across a reset
+	uint8_t buffer[SCRON_ALARM_PLAN_SIZE];
+	scron_alarm_plan_encode(&armed, buffer);
+	struct scron_alarm_plan decoded = {0};
+	CHECK(scron_alarm_plan_decode(&decoded, buffer));
+	CHECK(decoded.mode == armed.mode);
+	CHECK(decoded.wake == armed.wake);
+	CHECK(decoded.repeat == armed.repeat);
+	CHECK(decoded.period == armed.period);
+
+	// Run the tasks at each wake, and nothing has to be planned again
+	for (time_t wake = START + 50; wake < START + 50 + 60 * 10; wake += 60)
+	{
+		for (size_t i = 0; i < ARRAY_SIZE(cron_tasks); ++i)
+			scron_set_last_run(&scron, i, wake);
+		CHECK(scron_alarm_is_current(&scron, &config, &decoded, wake));
+		// Arming the next plan anyway leaves the alarm alone
+		CHECK(scron_alarm_plan(&scron, &config, wake, &plan));
+		CHECK(scron_alarm_arm(&rtc, &plan, &decoded, wake));
+	}
+	CHECK(mock.writes == writes);
+
+	// Until a task is late, and the wake moves off the grid
+	scron_set_last_run(&scron, 0, START + 50 + 60 * 10 + 5);
+	CHECK(!scron_alarm_is_current(&scron, &config, &decoded, START + 50 + 60 * 10 + 5));
+	scron_delete(&scron);
+}
+
+// Any less tolerance splits the tasks into unevenly spaced wakes
+static void test_uneven(void)
+{
+	struct scron scron;
+	init_cron(&scron);
+	const struct scron_alarm_config config = { .tolerance = 30, .retry = 10 };
+
+	struct scron_alarm_plan plan;
+	CHECK(scron_alarm_plan(&scron, &config, START, &plan));
+	CHECK(plan.period == 0);
+	CHECK(plan.wake > START && plan.wake <= START + 50);
+
+	struct scron_alarm_plan armed = {0};
+	mock.writes = 0;
+	CHECK(scron_alarm_arm(&rtc, &plan, &armed, START));
+	CHECK(mock.writes != 0);
+	// A plan that isn't periodic is never current
+	CHECK(!scron_alarm_is_current(&scron, &config, &armed, START));
+	scron_delete(&scron);
+}
+
+// A period the alarm can't repeat at uses the countdown timer
+static void test_countdown(void)
+{
+	static const struct scron_task tasks[] = {
+		{ .name = "slow", .function = task, .schedule = { .period = 90 } },
+	};
+	static const struct scron_tasks table = { ARRAY_SIZE(tasks), tasks };
+	struct scron scron;
+	if (!scron_init(&scron, &table))
+		exit(1);
+	scron_set_last_run(&scron, 0, START);
+	const struct scron_alarm_config config = {
+		.tolerance = 0, .retry = 10, .countdown = true,
+	};
+
+	struct scron_alarm_plan plan;
+	CHECK(scron_alarm_plan(&scron, &config, START, &plan));
+	CHECK(plan.mode == SCRON_ALARM_COUNTDOWN);
+	CHECK(plan.period == 90);
+
+	struct scron_alarm_plan armed = {0};
+	mock.writes = 0;
+	CHECK(scron_alarm_arm(&rtc, &plan, &armed, START));
+	CHECK(mock.period == 90);
+	size_t writes = mock.writes;
+	CHECK(writes != 0);
+
+	uint8_t buffer[SCRON_ALARM_PLAN_SIZE];
+	scron_alarm_plan_encode(&armed, buffer);
+	struct scron_alarm_plan decoded = {0};
+	CHECK(scron_alarm_plan_decode(&decoded, buffer));
+	CHECK(decoded.mode == SCRON_ALARM_COUNTDOWN);
+
+	scron_set_last_run(&scron, 0, plan.wake);
+	CHECK(scron_alarm_is_current(&scron, &config, &decoded, plan.wake));
+	// Arming the next plan anyway leaves the timer running
+	CHECK(scron_alarm_plan(&scron, &config, plan.wake, &plan));
+	CHECK(scron_alarm_arm(&rtc, &plan, &decoded, decoded.wake));
+	CHECK(mock.writes == writes);
+	scron_delete(&scron);
+}
+
+// Garbage in RTC RAM must not pass for a plan
+static void test_decode_corrupt(void)
+{
+	const struct scron_alarm_plan plan = {
+		.mode = SCRON_ALARM_MATCH,
+		.wake = START + 50,
+		.repeat = SCRON_ALARM_REPEAT_MINUTE,
+		.period = 60,
+	};
+	uint8_t buffer[SCRON_ALARM_PLAN_SIZE];
+	struct scron_alarm_plan decoded;
+	for (size_t i = 0; i < sizeof(buffer); ++i)
+	{
+		scron_alarm_plan_encode(&plan, buffer);
+		buffer[i] ^= 0x01;
+		CHECK(!scron_alarm_plan_decode(&decoded, buffer));
+	}
+	memset(buffer, 0, sizeof(buffer));
+	CHECK(!scron_alarm_plan_decode(&decoded, buffer));
+}
+
+int main(void)
+{
+	test_periodic();
+	test_uneven();
+	test_countdown();
+	test_decode_corrupt();
+
+	if (failures)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Host test for the scron journal: saving, loading back full and delta
+// records, compaction, and recovering from power lost in the middle of a
+// compaction. The journal files are created in the current directory.
+
+#include <scron.h>
+#include <scron_journal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
+
+static int failures;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *expression, int line)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "line %d: check failed: %s\n", line, expression);
+		++failures;
+	}
+}
+
+static int task(void *data)
+{
+	(void)data;
+	return 0;
+}
+
+static const struct scron_task tasks[] = {
+	{ .name = "alpha", .function = task, .schedule = { .period = 60 } },
+	{ .name = "beta", .function = task, .schedule = { .period = 60 } },
+};
+
+static const struct scron_tasks static_tasks = { ARRAY_SIZE(tasks), tasks };
+
+static const struct scron_journal journal = {
+	.path = "test_journal.bin",
+	.temporary_path = "test_journal.tmp",
+	.compact_size = 0,
+};
+
+static void put_le32(uint8_t *buffer, uint32_t value)
+{
+	for (size_t i = 0; i < 4; ++i)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static bool file_exists(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file)
+		fclose(file);
+	return file;
+}
+
+// Loads the journal into a new scron, and checks the history it ends up with
+static void check_load(const struct scron_journal *journal, time_t alpha, time_t beta)
+{
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	CHECK(scron_journal_load(journal, &scron));
+	CHECK(scron.history[0].last_run == alpha);
+	CHECK(scron.history[1].last_run == beta);
+	scron_delete(&scron);
+}
+
+static void test_deltas(void)
+{
+	remove(journal.path);
+	remove(journal.temporary_path);
+
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	scron_set_last_run(&scron, 0, 1000);
+	scron_set_last_run(&scron, 1, 2000);
+	CHECK(scron_journal_save(&journal, &scron, true));
+	scron_clear_dirty(&scron);
+
+	// Only beta goes into this delta, alpha comes from the full record
+	scron_set_last_run(&scron, 1, 3000);
+	CHECK(scron_journal_save(&journal, &scron, false));
+	scron_clear_dirty(&scron);
+	check_load(&journal, 1000, 3000);
+
+	// A torn record at the end is skipped
+	FILE *file = fopen(journal.path, "ab");
+	CHECK(file && fwrite("torn", 4, 1, file) == 1);
+	if (file)
+		fclose(file);
+	check_load(&journal, 1000, 3000);
+
+	// So is a footer with a corrupted size, which must not jump over the
+	// good records before it
+	file = fopen(journal.path, "ab");
+	CHECK(file && !fseek(file, 0, SEEK_END));
+	if (file)
+	{
+		uint8_t footer[12];
+		put_le32(footer, ftell(file) - 8);
+		put_le32(footer + 4, 0);
+		put_le32(footer + 8, SCRON_JOURNAL_MAGIC);
+		CHECK(fwrite(footer, sizeof(footer), 1, file) == 1);
+		fclose(file);
+	}
+	check_load(&journal, 1000, 3000);
+	scron_delete(&scron);
+}
+
+static void test_compaction(void)
+{
+	remove(journal.path);
+	remove(journal.temporary_path);
+
+	struct scron_journal compacting = journal;
+	compacting.compact_size = 256;
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	for (time_t i = 1; i <= 50; ++i)
+	{
+		scron_set_last_run(&scron, i % 2, i * 100);
+		CHECK(scron_journal_save(&compacting, &scron, i == 1));
+		scron_clear_dirty(&scron);
+	}
+	CHECK(!file_exists(journal.temporary_path));
+	FILE *file = fopen(journal.path, "rb");
+	CHECK(file && !fseek(file, 0, SEEK_END) && ftell(file) <= 256);
+	if (file)
+		fclose(file);
+	check_load(&compacting, 5000, 4900);
+	scron_delete(&scron);
+}
+
+// Power lost after the journal was removed but before the temporary file was
+// renamed over it, leaving only the temporary file with a full record
+static void test_interrupted_compaction(void)
+{
+	remove(journal.path);
+	remove(journal.temporary_path);
+
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	scron_set_last_run(&scron, 0, 1000);
+	scron_set_last_run(&scron, 1, 2000);
+	CHECK(scron_journal_save(&journal, &scron, true));
+	scron_delete(&scron);
+	CHECK(!rename(journal.path, journal.temporary_path));
+
+	// The boot after the power loss loads, and then saves only a delta
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	CHECK(scron_journal_load(&journal, &scron));
+	CHECK(file_exists(journal.path));
+	CHECK(!file_exists(journal.temporary_path));
+	scron_clear_dirty(&scron);
+	scron_set_last_run(&scron, 1, 3000);
+	CHECK(scron_journal_save(&journal, &scron, false));
+	scron_delete(&scron);
+
+	// Alpha's history is only in the record from the temporary file
+	check_load(&journal, 1000, 3000);
+}
+
+int main(void)
+{
+	test_deltas();
+	test_compaction();
+	test_interrupted_compaction();
+	remove(journal.path);
+	remove(journal.temporary_path);
+
+	if (failures)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
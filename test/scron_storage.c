@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Host test for the RTC RAM storage backend, with the RAM mocked by a buffer
+// and an in-memory fallback.
+
+#include <scron.h>
+#include <scron_storage.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
+
+static int failures;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool condition, const char *expression, int line)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "line %d: check failed: %s\n", line, expression);
+		++failures;
+	}
+}
+
+// Mock RTC RAM, which counts how much of it is read and can fail writes
+struct mock_ram
+{
+	uint8_t bytes[256];
+	size_t bytes_read;
+	size_t failing_writes;
+};
+
+static bool mock_read(void *data, size_t address, void *buffer, size_t size)
+{
+	struct mock_ram *ram = data;
+	if (address + size > sizeof(ram->bytes))
+		return false;
+	memcpy(buffer, ram->bytes + address, size);
+	ram->bytes_read += size;
+	return true;
+}
+
+static bool mock_write(void *data, size_t address, const void *buffer, size_t size)
+{
+	struct mock_ram *ram = data;
+	if (ram->failing_writes)
+	{
+		--ram->failing_writes;
+		return false;
+	}
+	if (address + size > sizeof(ram->bytes))
+		return false;
+	memcpy(ram->bytes + address, buffer, size);
+	return true;
+}
+
+static int task(void *data)
+{
+	(void)data;
+	return 0;
+}
+
+static const struct scron_task tasks[] = {
+	{ .name = "alpha", .function = task, .schedule = { .period = 60 } },
+	{ .name = "beta", .function = task, .schedule = { .period = 60 } },
+};
+
+static const struct scron_tasks static_tasks = { ARRAY_SIZE(tasks), tasks };
+
+static struct mock_ram ram;
+static uint8_t fallback_buffer[1024];
+static struct scron_memory_storage memory = {
+	.buffer = fallback_buffer,
+	.capacity = sizeof(fallback_buffer),
+};
+static struct scron_storage memory_storage;
+
+// In-memory fallback, which remembers whether it was asked for everything
+static bool fallback_full;
+
+static bool fallback_save(void *data, const struct scron *scron, bool full)
+{
+	(void)data;
+	fallback_full = full;
+	return memory_storage.save(memory_storage.data, scron, full);
+}
+
+static bool fallback_load(void *data, struct scron *scron)
+{
+	(void)data;
+	return memory_storage.load(memory_storage.data, scron);
+}
+
+static const struct scron_storage fallback = {
+	.save = fallback_save,
+	.load = fallback_load,
+};
+static struct scron_rtc_ram_storage rtc_ram = {
+	.read = mock_read,
+	.write = mock_write,
+	.data = &ram,
+	.size = sizeof(ram.bytes),
+	.fallback = &fallback,
+};
+static struct scron_storage storage;
+
+// Loads the history the way a boot does, and checks what it ends up with
+static void check_load(bool stats, time_t alpha, time_t beta)
+{
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	if (stats && !scron_enable_stats(&scron))
+		exit(1);
+	scron_storage_init_rtc_ram(&storage, &rtc_ram);
+	CHECK(scron_storage_load(&storage, &scron));
+	CHECK(scron.history[0].last_run == alpha);
+	CHECK(scron.history[1].last_run == beta);
+	scron_delete(&scron);
+}
+
+static void test_warm_start(void)
+{
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	scron_storage_init_memory(&memory_storage, &memory);
+	scron_storage_init_rtc_ram(&storage, &rtc_ram);
+	scron_set_last_run(&scron, 0, 1000);
+	scron_set_last_run(&scron, 1, 2000);
+	CHECK(scron_storage_save(&storage, &scron));
+	// Only the fallback being empty tells the RAM was used
+	CHECK(memory.size == 0);
+	scron_delete(&scron);
+
+	ram.bytes_read = 0;
+	check_load(false, 1000, 2000);
+	CHECK(ram.bytes_read == rtc_ram.synced_size);
+	CHECK(rtc_ram.synced_size < sizeof(ram.bytes));
+}
+
+// A snapshot that stops fitting in the RAM must not leave the old one behind
+// to be loaded over the newer history in the fallback
+static void test_too_large(void)
+{
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks) || !scron_enable_stats(&scron))
+		exit(1);
+	scron_storage_init_rtc_ram(&storage, &rtc_ram);
+	CHECK(scron_storage_load(&storage, &scron));
+	// Statistics for 2 tasks don't fit in 128 bytes, so this goes to the
+	// fallback
+	rtc_ram.size = 128;
+	scron_set_last_run(&scron, 0, 3000);
+	CHECK(scron_storage_save(&storage, &scron));
+	CHECK(rtc_ram.too_large);
+	CHECK(memory.size != 0);
+	CHECK(fallback_full);
+	// Now that the fallback has everything, it only needs what changed
+	scron_set_last_run(&scron, 0, 3500);
+	CHECK(scron_storage_save(&storage, &scron));
+	CHECK(!fallback_full);
+	scron_delete(&scron);
+
+	check_load(true, 3500, 2000);
+	rtc_ram.size = sizeof(ram.bytes);
+	check_load(false, 3500, 2000);
+}
+
+// Same for a RAM write that fails once
+static void test_write_failure(void)
+{
+	struct scron scron;
+	if (!scron_init(&scron, &static_tasks))
+		exit(1);
+	memory.size = 0;
+	scron_storage_init_rtc_ram(&storage, &rtc_ram);
+	scron_set_last_run(&scron, 0, 1000);
+	scron_set_last_run(&scron, 1, 2000);
+	CHECK(scron_storage_save(&storage, &scron));
+	CHECK(memory.size == 0);
+
+	ram.failing_writes = 1;
+	scron_set_last_run(&scron, 1, 4000);
+	CHECK(scron_storage_save(&storage, &scron));
+	CHECK(memory.size != 0);
+	scron_delete(&scron);
+
+	check_load(false, 1000, 4000);
+}
+
+// A static task that changed its schedule, but not its name, between builds
+// must not keep the next run of the old schedule
+static void test_schedule_change(void)
+{
+	static const struct scron_task daily[] = {
+		{ .name = "alpha", .function = task, .schedule = { .period = 86400, .phase = 10800 } },
+	};
+	static const struct scron_task minutely[] = {
+		{ .name = "alpha", .function = task, .schedule = { .period = 60 } },
+	};
+	const struct scron_tasks before = { ARRAY_SIZE(daily), daily };
+	const struct scron_tasks after = { ARRAY_SIZE(minutely), minutely };
+
+	struct scron scron;
+	if (!scron_init(&scron, &before))
+		exit(1);
+	scron_storage_init_rtc_ram(&storage, &rtc_ram);
+	scron_set_last_run(&scron, 0, 1000);
+	CHECK(scron_get_next_run(&scron, 0) == 10800);
+	CHECK(scron_storage_save(&storage, &scron));
+	scron_delete(&scron);
+
+	if (!scron_init(&scron, &after))
+		exit(1);
+	CHECK(scron_storage_load(&storage, &scron));
+	CHECK(scron.history[0].last_run == 1000);
+	CHECK(scron_get_next_run(&scron, 0) == 1020);
+	// The RAM has the old fingerprint, so it gets rewritten
+	CHECK(rtc_ram.synced_size == 0);
+	scron_delete(&scron);
+}
+
+int main(void)
+{
+	test_warm_start();
+	test_too_large();
+	test_write_failure();
+	test_schedule_change();
+
+	if (failures)
+	{
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
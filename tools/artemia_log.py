@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+# SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+"""Turns tokenized artemia logs back into text.
+
+Logs recorded with the ARTEMIA_LOG_* macros in artemia_log.h are flushed as
+tokens and raw arguments. The format strings they refer to are in the
+artemia_log section of the ELF that recorded them, which must be the exact
+build that ran. The input is a capture of whatever the logs were flushed to,
+e.g. the UART, and anything else in it, like the output of printf, is
+skipped.
+
+Every log is printed on its own line, prefixed with its level, E, W, I, or D.
+
+Usage: artemia_log.py elf log...
+"""
+
+import re
+import struct
+import sys
+
+MAGIC = b'ALOG'
+VERSION = 1
+HEADER = struct.Struct('<4sBBHI')
+SECTION = 'artemia_log'
+CONVERSION = re.compile(
+    r'%([-+ #0]*(?:\d+)?(?:\.\d+)?)(hh|h|ll|l|j|z|t|L)?([diouxXcsfFeEgGaA%])')
+
+
+class LogError(Exception):
+    pass
+
+
+def read_formats(path):
+    """Reads every format string in the artemia_log section of an ELF, by
+    their offset in the section, which is their token."""
+    with open(path, 'rb') as elf:
+        data = elf.read()
+    if data[:4] != b'\x7fELF':
+        raise LogError(f'{path}: not an ELF file')
+    wide = data[4] == 2
+    endian = '<' if data[5] == 1 else '>'
+    if wide:
+        shoff, = struct.unpack_from(endian + 'Q', data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + 'HHH', data, 0x3A)
+        section = struct.Struct(endian + 'IIQQQQIIQQ')
+    else:
+        shoff, = struct.unpack_from(endian + 'I', data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + 'HHH', data, 0x2E)
+        section = struct.Struct(endian + 'IIIIIIIIII')
+    sections = [section.unpack_from(data, shoff + i * shentsize) for i in range(shnum)]
+    names = sections[shstrndx]
+    for header in sections:
+        name_offset = names[4] + header[0]
+        name = data[name_offset:data.index(b'\0', name_offset)].decode()
+        if name == SECTION:
+            contents = data[header[4]:header[4] + header[5]]
+            break
+    else:
+        raise LogError(f'{path}: no {SECTION} section, nothing logs')
+
+    formats = {}
+    start = 0
+    while start < len(contents):
+        end = contents.index(b'\0', start)
+        if end > start:
+            formats[start] = contents[start:end].decode(errors='replace')
+        start = end + 1
+    return formats
+
+
+def get_varint(data, position):
+    value = 0
+    shift = 0
+    while True:
+        if position >= len(data):
+            raise LogError('record cut short')
+        byte = data[position]
+        position += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, position
+
+
+def decode(record, formats):
+    """Formats a single record."""
+    token, position = get_varint(record, 0)
+    if token not in formats:
+        raise LogError(f'unknown token {token}, is this the right ELF?')
+    level, format_string = formats[token][0], formats[token][1:]
+    parts = []
+    last = 0
+    for match in CONVERSION.finditer(format_string):
+        parts.append(format_string[last:match.start()])
+        last = match.end()
+        flags, length, conversion = match.groups()
+        if conversion == '%':
+            parts.append('%')
+            continue
+        if conversion == 's':
+            size = record[position]
+            value = record[position + 1:position + 1 + size].decode(errors='replace')
+            position += 1 + size
+        elif conversion in 'fFeEgGaA':
+            value, = struct.unpack_from('<f', record, position)
+            position += 4
+            conversion = 'e' if conversion in 'aA' else conversion
+        else:
+            zigzag, position = get_varint(record, position)
+            value = (zigzag >> 1) ^ -(zigzag & 1)
+            if conversion in 'ouxX':
+                value &= (1 << (64 if length in ('ll', 'j') else 32)) - 1
+        parts.append(f'%{flags}{conversion}' % value)
+    parts.append(format_string[last:])
+    return level, ''.join(parts).rstrip('\r\n')
+
+
+def parse(data, formats):
+    """Finds every flushed log in data, yielding (level, text)."""
+    position = data.find(MAGIC)
+    while position >= 0 and position + HEADER.size <= len(data):
+        _, version, reserved, size, dropped = HEADER.unpack_from(data, position)
+        if version != VERSION or reserved:
+            position = data.find(MAGIC, position + 1)
+            continue
+        start = position + HEADER.size
+        records = data[start:start + size]
+        offset = 0
+        while offset < len(records):
+            length = records[offset]
+            record = records[offset + 1:offset + 1 + length]
+            offset += 1 + length
+            try:
+                yield decode(record, formats)
+            except (LogError, IndexError, struct.error) as error:
+                yield '?', f'bad record: {error}'
+        if dropped:
+            yield 'W', f'{dropped} logs dropped, the log buffer was full'
+        position = data.find(MAGIC, start + size)
+
+
+def main(argv):
+    if len(argv) < 3:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 1
+    try:
+        formats = read_formats(argv[1])
+    except LogError as error:
+        print(error, file=sys.stderr)
+        return 1
+    for path in argv[2:]:
+        with open(path, 'rb') as log_file:
+            for level, text in parse(log_file.read(), formats):
+                print(f'{level} {text}')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,483 @@
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+// Discrete-event host simulator for scron and the artemia scheduler.
+//
+// This drives the real scheduler with a virtual clock instead of hardware.
+// The storage capacitor charges from a day/night harvesting profile and
+// discharges through every wake and task, each with a simulated energy cost
+// and duration. Between wakes, the simulation jumps straight to the next RTC
+// alarm, so months of simulated time take seconds. The alarm is planned and
+// armed like on the hardware, on a mock of the AM1815 alarm and countdown
+// timer. Every scheduling policy runs over the same profile, and the report
+// compares them.
+//
+// If a trace file is given, the last wakes of every policy are traced on the
+// host clock, and dumped to it for tools/artemia_trace.py.
+//
+// Usage: artemia_sim [days [trace]]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <scron.h>
+#include <scron_alarm.h>
+#include <artemia.h>
+#include <artemia_trace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
+
+// Storage capacitor, in farads and volts
+#define SIM_CAPACITANCE 0.047
+#define SIM_MAX_VOLTAGE 2.3
+// Below this the MCU browns out, and it can't boot
+#define SIM_FLOOR_VOLTAGE 1.7
+
+// Harvested power, in watts. Sunlight follows half a sine wave from 06:00 to
+// 18:00, on top of a small constant indoor light
+#define SIM_PEAK_POWER 1.0e-3
+#define SIM_BASE_POWER 20.0e-6
+// Power drawn while asleep, waiting for the RTC alarm
+#define SIM_SLEEP_POWER 5.0e-6
+
+// Energy and time it takes to boot, load the scheduler state, and save it
+#define SIM_WAKE_ENERGY 1.0e-3
+#define SIM_WAKE_DURATION 0.05
+// How long until the RTC alarm fires again if nothing could be scheduled
+#define SIM_RETRY_INTERVAL 60
+
+#define SIM_PI 3.14159265358979323846
+
+// Simulation start, 2023-01-01T00:00:00Z
+#define SIM_START 1672531200
+
+// Events kept of the end of every run, when tracing
+#define SIM_TRACE_EVENTS 4096
+
+struct sim_task
+{
+	const char *name;
+	const char *schedule;
+	double minimum_voltage;
+	time_t delta;
+	// Joules and seconds per run
+	double energy;
+	double duration;
+};
+
+// Mirrors src/tasks.json, with costs in the ballpark of the real sensors, and
+// deadlines so policies have something to order by
+static const struct sim_task sim_tasks[] = {
+	{ "temperature", "10 * * * * *", 1.8, 30, 2.0e-3, 0.05 },
+	{ "pressure", "20 * * * * *", 1.9, 30, 3.0e-3, 0.05 },
+	{ "light", "30 * * * * *", 1.8, 55, 2.0e-3, 0.02 },
+	{ "microphone", "40 * * * * *", 2.0, 10, 15.0e-3, 0.5 },
+	{ "lora", "50 * * * * *", 1.8, 5, 25.0e-3, 1.0 },
+};
+
+struct sim_policy
+{
+	const char *name;
+	enum artemia_policy policy;
+	size_t max_tasks;
+	bool energy_model;
+	// Wake coalescing tolerance, see scron_next_wake
+	time_t tolerance;
+};
+
+// One task per call is what artemia_scheduler does
+static const struct sim_policy sim_policies[] = {
+	{ "single", ARTEMIA_POLICY_LRU, 1, false, 0 },
+	{ "lru", ARTEMIA_POLICY_LRU, 0, false, 0 },
+	{ "edf", ARTEMIA_POLICY_EDF, 0, false, 0 },
+	{ "lru-energy", ARTEMIA_POLICY_LRU, 0, true, 0 },
+	{ "edf-energy", ARTEMIA_POLICY_EDF, 0, true, 0 },
+	{ "coalesce", ARTEMIA_POLICY_EDF, 0, true, 30 },
+};
+
+struct sim_results
+{
+	size_t runs[ARRAY_SIZE(sim_tasks)];
+	size_t missed;
+	size_t wakes;
+	size_t wasted_wakes;
+	size_t dead_wakes;
+	size_t brownouts;
+	size_t rtc_writes;
+	double lateness_total;
+	time_t lateness_max;
+};
+
+// Mock AM1815. The alarm fires whenever the clock matches the alarm time in
+// every field finer than its repeat, and the countdown timer fires every
+// period seconds from when it was started. Its RAM keeps what it's armed
+// with, like main does
+struct sim_rtc
+{
+	time_t alarm;
+	enum scron_alarm_repeat repeat;
+	time_t countdown;
+	uint32_t period;
+	uint8_t armed[SCRON_ALARM_PLAN_SIZE];
+};
+
+struct sim
+{
+	const struct scron *scron;
+	// Virtual time in seconds, and energy in the capacitor in joules
+	double clock;
+	double energy;
+	bool browned_out;
+	// Index of the task about to run
+	size_t current;
+	struct sim_rtc rtc;
+	struct sim_results results;
+};
+
+static bool sim_rtc_write_alarm(void *data, time_t time, enum scron_alarm_repeat repeat)
+{
+	struct sim *sim = data;
+	sim->rtc.alarm = time;
+	sim->rtc.repeat = repeat;
+	sim->results.rtc_writes += 1;
+	return true;
+}
+
+static bool sim_rtc_write_countdown(void *data, uint32_t first, uint32_t period)
+{
+	struct sim *sim = data;
+	sim->rtc.countdown = (time_t)sim->clock + first;
+	sim->rtc.period = period;
+	sim->results.rtc_writes += 1;
+	return true;
+}
+
+// Next time the mock RTC fires, strictly after time
+static time_t sim_rtc_next(const struct sim_rtc *rtc, time_t time)
+{
+	time_t next = SCRON_NEVER;
+	time_t interval = scron_alarm_repeat_interval(rtc->repeat);
+	if (interval)
+	{
+		time_t offset = (time - rtc->alarm) % interval;
+		if (offset < 0)
+			offset += interval;
+		next = time + interval - offset;
+	}
+	else if (rtc->repeat != SCRON_ALARM_REPEAT_NONE && rtc->alarm > time)
+	{
+		// Monthly and yearly alarms are only simulated until they first fire
+		next = rtc->alarm;
+	}
+
+	if (rtc->period)
+	{
+		time_t countdown = rtc->countdown;
+		if (countdown <= time)
+			countdown += ((time - countdown) / rtc->period + 1) * rtc->period;
+		if (countdown < next)
+			next = countdown;
+	}
+	return next;
+}
+
+// Arms the mock RTC for the next wake like main does after a cold boot,
+// only knowing what the RTC is armed with from its RAM
+static void sim_arm(struct sim *sim, const struct scron_rtc *rtc,
+	const struct scron_alarm_config *config, time_t now)
+{
+	struct scron_alarm_plan armed = {0};
+	scron_alarm_plan_decode(&armed, sim->rtc.armed);
+	if (scron_alarm_is_current(sim->scron, config, &armed, now))
+		return;
+	struct scron_alarm_plan plan;
+	if (!scron_alarm_plan(sim->scron, config, now, &plan))
+		return;
+	if (!scron_alarm_arm(rtc, &plan, &armed, now))
+		armed = (struct scron_alarm_plan){0};
+	scron_alarm_plan_encode(&armed, sim->rtc.armed);
+}
+
+static double sim_energy_at(double voltage)
+{
+	return SIM_CAPACITANCE * voltage * voltage / 2.0;
+}
+
+static double sim_voltage(const struct sim *sim)
+{
+	return sqrt(2.0 * sim->energy / SIM_CAPACITANCE);
+}
+
+static double sim_harvest_power(double clock)
+{
+	double day = fmod(clock, 86400.0) / 86400.0;
+	double sun = sin((day - 0.25) * 2.0 * SIM_PI);
+	return SIM_BASE_POWER + (sun > 0.0 ? SIM_PEAK_POWER * sun : 0.0);
+}
+
+// Moves the clock forward, charging or draining the capacitor along the way
+static void sim_advance(struct sim *sim, double seconds, double load)
+{
+	const double max_energy = sim_energy_at(SIM_MAX_VOLTAGE);
+	while (seconds > 0.0)
+	{
+		// Steps short enough that the harvest is about constant within each
+		double step = seconds < 60.0 ? seconds : 60.0;
+		double power = sim_harvest_power(sim->clock + step / 2.0) - load;
+		sim->energy += power * step;
+		if (sim->energy > max_energy)
+			sim->energy = max_energy;
+		if (sim->energy < 0.0)
+			sim->energy = 0.0;
+		sim->clock += step;
+		seconds -= step;
+	}
+}
+
+static double sim_read_voltage(void *data)
+{
+	return sim_voltage(data);
+}
+
+static bool sim_prepare_task(void *data, const struct scron_task *task)
+{
+	struct sim *sim = data;
+	if (sim->browned_out)
+		return false;
+	sim->current = scron_find_task(sim->scron, task->name);
+
+	time_t late = (time_t)sim->clock - scron_get_next_run(sim->scron, sim->current);
+	if (late < 0)
+		late = 0;
+	sim->results.lateness_total += late;
+	if (late > sim->results.lateness_max)
+		sim->results.lateness_max = late;
+	return true;
+}
+
+static struct sim *running_sim;
+
+// Every task runs through here, charging the cost of whichever task is
+// current
+static int sim_task_function(void *data)
+{
+	(void)data;
+	struct sim *sim = running_sim;
+	const struct sim_task *task = &sim_tasks[sim->current];
+	sim->energy -= task->energy;
+	sim_advance(sim, task->duration, 0.0);
+	if (sim_voltage(sim) < SIM_FLOOR_VOLTAGE)
+	{
+		// The task didn't finish. It still counts as run to scron, like it
+		// would if the history was saved before running tasks
+		sim->browned_out = true;
+		sim->results.brownouts += 1;
+		return -1;
+	}
+	sim->results.runs[sim->current] += 1;
+	return 0;
+}
+
+// Stamps trace events with the host's monotonic clock, in nanoseconds
+static uint32_t sim_trace_clock(void *data)
+{
+	(void)data;
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint32_t)(time.tv_sec * 1000000000LL + time.tv_nsec);
+}
+
+static bool sim_trace_write(void *data, const void *buffer, size_t size)
+{
+	return fwrite(buffer, 1, size, data) == size;
+}
+
+static void sim_run(const struct sim_policy *policy, time_t duration,
+	struct artemia_trace *trace, struct sim_results *results)
+{
+	static struct scron_task tasks[ARRAY_SIZE(sim_tasks)];
+	for (size_t i = 0; i < ARRAY_SIZE(sim_tasks); ++i)
+	{
+		memset(&tasks[i], 0, sizeof(tasks[i]));
+		strncpy(tasks[i].name, sim_tasks[i].name, sizeof(tasks[i].name) - 1);
+		tasks[i].minimum_millivolts = lround(sim_tasks[i].minimum_voltage * 1000.0);
+		tasks[i].function = sim_task_function;
+		tasks[i].delta = sim_tasks[i].delta;
+		tasks[i].schedule.hour = -1;
+		tasks[i].schedule.minute = -1;
+		tasks[i].schedule.second = -1;
+		if (!scron_cron_parse(&tasks[i].schedule.cron, sim_tasks[i].schedule))
+		{
+			fprintf(stderr, "bad schedule for %s\n", sim_tasks[i].name);
+			exit(1);
+		}
+	}
+	const struct scron_tasks table = { ARRAY_SIZE(tasks), tasks };
+
+	struct scron scron;
+	if (!scron_init(&scron, &table))
+	{
+		fprintf(stderr, "scron_init: out of memory\n");
+		exit(1);
+	}
+	// Pretend every task just ran, so the first wake isn't a pile up
+	for (size_t i = 0; i < ARRAY_SIZE(tasks); ++i)
+		scron_set_last_run(&scron, i, SIM_START);
+
+	struct sim sim = {
+		.scron = &scron,
+		.clock = SIM_START,
+		.energy = sim_energy_at(SIM_MAX_VOLTAGE),
+	};
+	running_sim = &sim;
+	struct artemia_config config = {
+		.read_voltage = sim_read_voltage,
+		.voltage_data = &sim,
+		.max_tasks = policy->max_tasks,
+		.policy = policy->policy,
+		.prepare_task = sim_prepare_task,
+		.prepare_data = &sim,
+		.trace = trace,
+	};
+	if (policy->energy_model)
+	{
+		config.capacitor.capacitance = lround(SIM_CAPACITANCE * 1e6);
+		config.capacitor.floor_voltage = lround(SIM_FLOOR_VOLTAGE * 1000.0);
+	}
+
+	const struct scron_rtc rtc = {
+		.write_alarm = sim_rtc_write_alarm,
+		.write_countdown = sim_rtc_write_countdown,
+		.data = &sim,
+	};
+	const struct scron_alarm_config alarm_config = {
+		.tolerance = policy->tolerance,
+		.retry = SIM_RETRY_INTERVAL,
+		.countdown = true,
+	};
+
+	const double end = (double)SIM_START + duration;
+	sim_arm(&sim, &rtc, &alarm_config, SIM_START);
+	time_t alarm = sim_rtc_next(&sim.rtc, SIM_START);
+	while (sim.clock < end)
+	{
+		if (alarm == SCRON_NEVER)
+			break;
+		sim_advance(&sim, alarm - sim.clock, SIM_SLEEP_POWER);
+		sim.results.wakes += 1;
+		if (sim_voltage(&sim) < SIM_FLOOR_VOLTAGE)
+		{
+			// Not enough energy to even boot, wait for the alarm to repeat
+			sim.results.dead_wakes += 1;
+			alarm = sim_rtc_next(&sim.rtc, (time_t)sim.clock);
+			continue;
+		}
+		sim.energy -= SIM_WAKE_ENERGY;
+		sim_advance(&sim, SIM_WAKE_DURATION, 0.0);
+
+		// Like main, keep going until the scheduler runs out of tasks
+		size_t ran = 0;
+		sim.browned_out = false;
+		for (;;)
+		{
+			struct artemia_stats stats;
+			size_t count = artemia_scheduler_batch(&scron, &config,
+				sim_voltage(&sim), (time_t)sim.clock, &stats);
+			sim.results.missed += stats.missed;
+			ran += count;
+			if (!count || sim.browned_out)
+				break;
+		}
+		if (!ran)
+			sim.results.wasted_wakes += 1;
+
+		const time_t now = (time_t)sim.clock;
+		artemia_trace_record(trace, ARTEMIA_TRACE_ALARM_BEGIN, 0);
+		sim_arm(&sim, &rtc, &alarm_config, now);
+		artemia_trace_record(trace, ARTEMIA_TRACE_ALARM_END, 0);
+		alarm = sim_rtc_next(&sim.rtc, now);
+	}
+
+	*results = sim.results;
+	scron_delete(&scron);
+}
+
+static void sim_report(FILE *out, const struct sim_policy *policy,
+	const struct sim_results *results, double days)
+{
+	size_t runs = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(sim_tasks); ++i)
+		runs += results->runs[i];
+	fprintf(out, "%-11s %9.1f %8zu %9.2f %7ld %8zu %7.1f%% %6zu %6zu %8.1f",
+		policy->name, runs / days, results->missed,
+		runs ? results->lateness_total / runs : 0.0, (long)results->lateness_max,
+		results->wakes,
+		results->wakes ? 100.0 * results->wasted_wakes / results->wakes : 0.0,
+		results->dead_wakes, results->brownouts, results->rtc_writes / days);
+	for (size_t i = 0; i < ARRAY_SIZE(sim_tasks); ++i)
+		fprintf(out, " %9.1f", results->runs[i] / days);
+	fprintf(out, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	long days = 90;
+	if (argc > 1)
+	{
+		char *end;
+		days = strtol(argv[1], &end, 10);
+		if (*end || days <= 0 || argc > 3)
+		{
+			fprintf(stderr, "usage: %s [days [trace]]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	static struct artemia_trace_event trace_events[SIM_TRACE_EVENTS];
+	struct artemia_trace trace;
+	FILE *trace_file = NULL;
+	if (argc > 2)
+	{
+		trace_file = fopen(argv[2], "wb");
+		if (!trace_file)
+		{
+			fprintf(stderr, "unable to open %s\n", argv[2]);
+			return 1;
+		}
+		artemia_trace_init(&trace, trace_events, SIM_TRACE_EVENTS,
+			sim_trace_clock, NULL, 1000000000);
+	}
+
+	FILE *out = stdout;
+
+	fprintf(out, "%ld simulated days, %zu tasks\n\n", days, ARRAY_SIZE(sim_tasks));
+	fprintf(out, "%-11s %9s %8s %9s %7s %8s %8s %6s %6s %8s",
+		"policy", "runs/day", "missed", "late avg", "max", "wakes", "wasted",
+		"dead", "brown", "rtc/day");
+	for (size_t i = 0; i < ARRAY_SIZE(sim_tasks); ++i)
+		fprintf(out, " %9.9s", sim_tasks[i].name);
+	fprintf(out, "\n");
+
+	for (size_t i = 0; i < ARRAY_SIZE(sim_policies); ++i)
+	{
+		struct sim_results results;
+		sim_run(&sim_policies[i], days * 86400, trace_file ? &trace : NULL, &results);
+		sim_report(out, &sim_policies[i], &results, days);
+		fflush(out);
+		if (trace_file && !artemia_trace_dump(&trace, SIM_START + days * 86400,
+				sim_trace_write, trace_file))
+		{
+			fprintf(stderr, "unable to write the trace\n");
+			return 1;
+		}
+	}
+	if (trace_file)
+		fclose(trace_file);
+	return 0;
+}
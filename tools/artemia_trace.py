@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+# SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+"""Decodes artemia trace dumps into a timeline and a flame summary.
+
+The input is one or more files of dumps written by artemia_trace_dump, e.g.
+fs:/artemia.trace.old and fs:/artemia.trace copied off the flash, in that
+order, a capture of the UART, or the trace written by artemia_sim. Anything between dumps, like the log on the UART, is
+skipped. Every dump is decoded on its own, as the clock restarts every wake.
+
+The timeline lists every event, indented by the spans it is in. The flame
+summary adds up the time spent in every span by the spans it is nested in,
+with the time spent in the span itself, not counting the spans in it, as
+self. With --folded, the spans are written out as folded stacks instead, one
+per line with their self time in microseconds, for flamegraph.pl or
+speedscope.
+
+Task indices are named after the tasks in the JSON task table given with
+--tasks, which is in the same order as the static tasks in scron.
+
+Usage: artemia_trace.py [--tasks tasks.json] [--summary | --folded] trace...
+"""
+
+import argparse
+import datetime
+import json
+import struct
+import sys
+
+MAGIC = b'ATRC'
+VERSION = 1
+HEADER = struct.Struct('<4sBBHIqII')
+EVENT = struct.Struct('<IBBH')
+
+# Mirrors enum artemia_trace_type in artemia_trace.h: name, and whether the
+# event begins (1) or ends (-1) a span, or is a point in time (0)
+EVENTS = {
+    1: ('scheduler', 1),
+    2: ('scheduler', -1),
+    3: ('task', 1),
+    4: ('task', -1),
+    5: ('selected', 0),
+    6: ('skipped', 0),
+    7: ('missed', 0),
+    8: ('fs mount', 1),
+    9: ('fs mount', -1),
+    10: ('load', 1),
+    11: ('load', -1),
+    12: ('save', 1),
+    13: ('save', -1),
+    14: ('alarm', 1),
+    15: ('alarm', -1),
+    16: ('fft', 1),
+    17: ('fft', -1),
+}
+TASK_EVENTS = {'task', 'selected', 'skipped', 'missed'}
+
+
+class Dump:
+    def __init__(self, clock_hz, time, lost, events):
+        self.clock_hz = clock_hz
+        self.time = time
+        self.lost = lost
+        # (ticks since the first event, type, argument)
+        self.events = events
+
+
+def parse(data):
+    """Finds and decodes every dump in data."""
+    dumps = []
+    position = data.find(MAGIC)
+    while position >= 0 and position + HEADER.size <= len(data):
+        (_, version, event_size, reserved, clock_hz, time, count,
+         lost) = HEADER.unpack_from(data, position)
+        start = position + HEADER.size
+        if (version != VERSION or event_size != EVENT.size or reserved or
+                not clock_hz):
+            position = data.find(MAGIC, position + 1)
+            continue
+        # A dump cut short, e.g. by a reset, keeps the events it has, up to
+        # whatever came after it
+        count = min(count, (len(data) - start) // event_size)
+        events = []
+        ticks = 0
+        previous = None
+        for i in range(count):
+            timestamp, kind, reserved, argument = EVENT.unpack_from(
+                data, start + i * event_size)
+            if kind not in EVENTS or reserved:
+                count = i
+                break
+            # The clock wraps around, but never between two events
+            if previous is not None:
+                ticks += (timestamp - previous) & 0xFFFFFFFF
+            previous = timestamp
+            events.append((ticks, kind, argument))
+        dumps.append(Dump(clock_hz, time, lost, events))
+        position = data.find(MAGIC, start + count * event_size)
+    return dumps
+
+
+def label(kind, argument, tasks):
+    name, direction = EVENTS[kind]
+    if name in TASK_EVENTS:
+        name += f' {tasks[argument] if argument < len(tasks) else argument}'
+    if name == 'scheduler' and direction < 0:
+        name += f', ran {argument}'
+    return {1: 'begin ', -1: 'end '}.get(direction, '') + name
+
+
+def spans(dump, tasks):
+    """Pairs up the span events of a dump, yielding (stack, ticks, self ticks)
+    for every span, innermost first. Ends whose begin was overwritten are
+    dropped, and spans still open at the end of the dump end there."""
+    stack = []
+    for ticks, kind, argument in dump.events:
+        name, direction = EVENTS[kind]
+        key = f'{name} {tasks[argument] if argument < len(tasks) else argument}' \
+            if name == 'task' else name
+        if direction > 0:
+            stack.append([key, ticks, 0])
+        elif direction < 0 and any(entry[0] == key for entry in stack):
+            while stack:
+                entry = stack.pop()
+                total = ticks - entry[1]
+                path = tuple(e[0] for e in stack) + (entry[0],)
+                yield path, total, total - entry[2]
+                if stack:
+                    stack[-1][2] += total
+                if entry[0] == key:
+                    break
+    end = dump.events[-1][0] if dump.events else 0
+    while stack:
+        entry = stack.pop()
+        total = end - entry[1]
+        path = tuple(e[0] for e in stack) + (entry[0],)
+        yield path, total, total - entry[2]
+        if stack:
+            stack[-1][2] += total
+
+
+def microseconds(ticks, clock_hz):
+    return ticks * 1e6 / clock_hz
+
+
+def print_timeline(dumps, tasks):
+    for dump in dumps:
+        time = datetime.datetime.fromtimestamp(dump.time, datetime.timezone.utc)
+        print(f'dump at {time.isoformat()}, {len(dump.events)} events, '
+              f'{dump.lost} lost, {dump.clock_hz} Hz')
+        depth = 0
+        for ticks, kind, argument in dump.events:
+            direction = EVENTS[kind][1]
+            if direction < 0:
+                depth = max(depth - 1, 0)
+            print(f'{microseconds(ticks, dump.clock_hz):14.3f} us  '
+                  f'{"  " * depth}{label(kind, argument, tasks)}')
+            if direction > 0:
+                depth += 1
+        print()
+
+
+def summarize(dumps, tasks):
+    """Adds up every span by its stack, in microseconds."""
+    summary = {}
+    for dump in dumps:
+        for path, total, own in spans(dump, tasks):
+            entry = summary.setdefault(path, [0, 0.0, 0.0])
+            entry[0] += 1
+            entry[1] += microseconds(total, dump.clock_hz)
+            entry[2] += microseconds(own, dump.clock_hz)
+    return summary
+
+
+def print_summary(summary):
+    print(f'{"total us":>14} {"self us":>14} {"count":>8}  span')
+    # Children right after their parent, busiest first
+    def order(path):
+        return tuple((-summary.get(path[:i + 1], (0, 0.0))[1], path[i])
+                     for i in range(len(path)))
+    for path in sorted(summary, key=order):
+        count, total, own = summary[path]
+        print(f'{total:14.3f} {own:14.3f} {count:8}  '
+              f'{"  " * (len(path) - 1)}{path[-1]}')
+
+
+def print_folded(summary):
+    for path in sorted(summary):
+        print(f'{";".join(path)} {round(summary[path][2])}')
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--tasks', help='JSON task table, to name tasks')
+    output = parser.add_mutually_exclusive_group()
+    output.add_argument('--summary', action='store_true',
+                        help='only print the flame summary')
+    output.add_argument('--folded', action='store_true',
+                        help='print folded stacks instead')
+    parser.add_argument('traces', nargs='+', help='trace dump files')
+    args = parser.parse_args(argv[1:])
+
+    tasks = []
+    if args.tasks:
+        with open(args.tasks, encoding='utf-8') as tasks_file:
+            tasks = [task.get('name', task.get('function'))
+                     for task in json.load(tasks_file).get('tasks', [])]
+
+    dumps = []
+    for path in args.traces:
+        with open(path, 'rb') as trace_file:
+            found = parse(trace_file.read())
+        if not found:
+            print(f'{path}: no trace dumps found', file=sys.stderr)
+            return 1
+        dumps += found
+
+    summary = summarize(dumps, tasks)
+    if args.folded:
+        print_folded(summary)
+        return 0
+    if not args.summary:
+        print_timeline(dumps, tasks)
+    print_summary(summary)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
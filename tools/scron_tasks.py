@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+# SPDX-FileCopyrightText: Gabriel Marcano, 2023
+
+"""Generates a constant scron static task table from a JSON description.
+
+The JSON file contains an object with a "tasks" list. Each task is an object
+with the following keys:
+ - function: name of the C task function, `int function(void *data)`
+ - name: name of the task, defaults to the function name
+ - minimum_voltage: minimum storage voltage needed to run the task, in volts.
+   It is stored in millivolts, rounded to the nearest one
+ - schedule: six field cron expression, see scron_cron_parse in scron.h
+ - delta: optional, seconds after the scheduled time the task may still run
+ - needs_fs: optional, whether the task uses the filesystem, defaults to false
+
+Every task is validated here, so a bad table fails the build instead of
+misbehaving on the device. The generated C file defines the const task table,
+so it lives in flash, along with each schedule's compiled bitmasks and, for
+schedules that fire at a fixed interval, their period and phase. The
+generated header also has the size of a snapshot of the table, so the build
+can check that the history fits where it is kept, e.g. the RTC RAM.
+
+Usage: scron_tasks.py input.json output.c output.h
+"""
+
+import json
+import os
+import re
+import sys
+
+NAME_MAX = 31
+FIELDS = (
+    ('second', 0, 59),
+    ('minute', 0, 59),
+    ('hour', 0, 23),
+    ('day of the month', 1, 31),
+    ('month', 1, 12),
+    ('day of the week', 0, 7),
+)
+DAY_OR = 0x01
+MONTH_DAYS = (31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31)
+
+
+class TaskError(Exception):
+    pass
+
+
+def parse_field(text, field):
+    """Parses a single cron field, returning its mask and whether it was *."""
+    name, low_limit, high_limit = field
+    mask = 0
+    star = False
+    for item in text.split(','):
+        match = re.fullmatch(r'(\*|(\d+)(?:-(\d+))?)(?:/(\d+))?', item)
+        if not match:
+            raise TaskError(f'bad {name} field "{text}"')
+        step = int(match.group(4)) if match.group(4) else 1
+        if match.group(1) == '*':
+            low, high = low_limit, high_limit
+            star = True
+        else:
+            low = int(match.group(2))
+            if match.group(3):
+                high = int(match.group(3))
+            elif match.group(4):
+                high = high_limit
+            else:
+                high = low
+        if step == 0 or low < low_limit or high > high_limit or low > high:
+            raise TaskError(f'bad {name} field "{text}"')
+        # Like scron_cron_parse, any step, in any item, means the field
+        # isn't a plain *
+        if match.group(4):
+            star = False
+        for i in range(low, high + 1, step):
+            mask |= 1 << i
+    return mask, star
+
+
+def parse_cron(expression):
+    """Compiles a cron expression the same way scron_cron_parse does."""
+    fields = expression.split()
+    if len(fields) != len(FIELDS):
+        raise TaskError(f'cron expression "{expression}" needs {len(FIELDS)} fields')
+    parsed = [parse_field(text, field) for text, field in zip(fields, FIELDS)]
+    masks = [mask for mask, _ in parsed]
+    if masks[5] & (1 << 7):
+        masks[5] = (masks[5] | 1) & ~(1 << 7)
+    flags = 0
+    if not parsed[3][1] and not parsed[5][1]:
+        flags |= DAY_OR
+    return {
+        'seconds': masks[0],
+        'minutes': masks[1],
+        'hours': masks[2],
+        'days': masks[3],
+        'months': masks[4],
+        'weekdays': masks[5],
+        'flags': flags,
+    }
+
+
+def fires(cron):
+    """Checks whether a schedule ever fires."""
+    if not all((cron['seconds'], cron['minutes'], cron['hours'], cron['months'])):
+        return False
+    if cron['flags'] & DAY_OR:
+        return bool(cron['days'] | cron['weekdays'])
+    # Every day of the month falls on every day of the week eventually, so
+    # only check that some selected day exists in some selected month
+    longest = max(MONTH_DAYS[month - 1] for month in bits(cron['months']))
+    return bool(cron['weekdays']) and any(day <= longest for day in bits(cron['days']))
+
+
+def bits(mask):
+    return [i for i in range(mask.bit_length()) if mask & (1 << i)]
+
+
+def period_phase(cron):
+    """Returns (period, phase) if the schedule fires at a fixed interval, or
+    (0, 0) otherwise."""
+    every_day = (cron['days'] == 0xFFFFFFFE and cron['months'] == 0x1FFE and
+                 cron['weekdays'] == 0x7F and not cron['flags'])
+    if not every_day:
+        return 0, 0
+    fires = sorted(h * 3600 + m * 60 + s
+                   for h in bits(cron['hours'])
+                   for m in bits(cron['minutes'])
+                   for s in bits(cron['seconds']))
+    gaps = {b - a for a, b in zip(fires, fires[1:])}
+    gaps.add(fires[0] + 86400 - fires[-1])
+    if len(gaps) != 1:
+        return 0, 0
+    period = gaps.pop()
+    return period, fires[0] % period
+
+
+def validate(task, names):
+    for key in task:
+        if key not in ('function', 'name', 'minimum_voltage', 'schedule', 'delta',
+                       'needs_fs'):
+            raise TaskError(f'unknown key "{key}"')
+    function = task.get('function')
+    if not isinstance(function, str) or not re.fullmatch(r'[A-Za-z_]\w*', function):
+        raise TaskError(f'bad function "{function}"')
+    name = task.get('name', function)
+    if not isinstance(name, str) or not name or len(name.encode()) > NAME_MAX:
+        raise TaskError(f'name "{name}" must be 1 to {NAME_MAX} bytes long')
+    if '"' in name or '\\' in name:
+        raise TaskError(f'name "{name}" has characters that need escaping')
+    if name in names:
+        raise TaskError(f'duplicate name "{name}"')
+    voltage = task.get('minimum_voltage')
+    if not isinstance(voltage, (int, float)) or not 0 <= voltage <= 65.535:
+        raise TaskError(f'bad minimum_voltage "{voltage}"')
+    schedule = task.get('schedule')
+    if not isinstance(schedule, str):
+        raise TaskError('missing schedule')
+    cron = parse_cron(schedule)
+    if not fires(cron):
+        raise TaskError(f'schedule "{schedule}" never fires')
+    delta = task.get('delta', 0)
+    if not isinstance(delta, int) or delta < 0:
+        raise TaskError(f'bad delta "{delta}"')
+    needs_fs = task.get('needs_fs', False)
+    if not isinstance(needs_fs, bool):
+        raise TaskError(f'bad needs_fs "{needs_fs}"')
+    period, phase = period_phase(cron)
+    return {
+        'function': function,
+        'name': name,
+        'minimum_millivolts': round(voltage * 1000),
+        'schedule': schedule,
+        'cron': cron,
+        'period': period,
+        'phase': phase,
+        'delta': delta,
+        'flags': ['SCRON_TASK_NEEDS_FS'] if needs_fs else [],
+    }
+
+
+def generate_source(tasks, header):
+    lines = [
+        f'// Generated by {os.path.basename(__file__)}, do not edit.',
+        '',
+        f'#include "{header}"',
+        '',
+        '#include <scron.h>',
+        '',
+        '#include <stdint.h>',
+        '',
+        'static const struct scron_task scron_static_task_table[] = {',
+    ]
+    for task in tasks:
+        cron = task['cron']
+        lines += [
+            '\t{',
+            f'\t\t.name = "{task["name"]}",',
+            f'\t\t.minimum_millivolts = {task["minimum_millivolts"]},',
+            f'\t\t.function = {task["function"]},',
+            f'\t\t// {task["schedule"]}',
+            '\t\t.schedule = {',
+            '\t\t\t.hour = -1,',
+            '\t\t\t.minute = -1,',
+            '\t\t\t.second = -1,',
+            '\t\t\t.cron = {',
+            f'\t\t\t\t.seconds = UINT64_C(0x{cron["seconds"]:X}),',
+            f'\t\t\t\t.minutes = UINT64_C(0x{cron["minutes"]:X}),',
+            f'\t\t\t\t.hours = 0x{cron["hours"]:X},',
+            f'\t\t\t\t.days = 0x{cron["days"]:X},',
+            f'\t\t\t\t.months = 0x{cron["months"]:X},',
+            f'\t\t\t\t.weekdays = 0x{cron["weekdays"]:X},',
+            f'\t\t\t\t.flags = 0x{cron["flags"]:X},',
+            '\t\t\t},',
+            f'\t\t\t.period = {task["period"]},',
+            f'\t\t\t.phase = {task["phase"]},',
+            '\t\t},',
+            f'\t\t.delta = {task["delta"]},',
+            f'\t\t.flags = {" | ".join(task["flags"]) or "0"},',
+            '\t},',
+        ]
+    lines += [
+        '};',
+        '',
+        'const struct scron_tasks scron_static_tasks = {',
+        '\t.size = sizeof(scron_static_task_table) / sizeof(scron_static_task_table[0]),',
+        '\t.tasks = scron_static_task_table,',
+        '};',
+        '',
+    ]
+    return '\n'.join(lines)
+
+
+def generate_header(tasks, header):
+    guard = re.sub(r'\W', '_', header).upper() + '_'
+    lines = [
+        f'// Generated by {os.path.basename(__file__)}, do not edit.',
+        '',
+        f'#ifndef {guard}',
+        f'#define {guard}',
+        '',
+        '#include <scron.h>',
+        '',
+    ]
+    for function in sorted({task['function'] for task in tasks}):
+        lines.append(f'int {function}(void *data);')
+    names_size = sum(len(task['name'].encode()) + 1 for task in tasks)
+    lines += [
+        '',
+        '/** Constant table of all static tasks, in flash. */',
+        'extern const struct scron_tasks scron_static_tasks;',
+        '',
+        '/** Number of static tasks. */',
+        f'#define SCRON_STATIC_TASKS_COUNT {len(tasks)}',
+        '',
+        '/** Size of the names of all static tasks, with their terminators, in',
+        ' *  bytes.',
+        ' */',
+        f'#define SCRON_STATIC_TASKS_NAMES_SIZE {names_size}',
+        '',
+        '/** Size of a snapshot of all static tasks without statistics, in bytes,',
+        ' *  see scron_serialized_size.',
+        ' */',
+        '#define SCRON_STATIC_TASKS_SNAPSHOT_SIZE (SCRON_SNAPSHOT_HEADER_SIZE + \\',
+        '\tSCRON_STATIC_TASKS_COUNT * SCRON_SNAPSHOT_ENTRY_SIZE + \\',
+        '\tSCRON_STATIC_TASKS_NAMES_SIZE)',
+        '',
+        f'#endif//{guard}',
+        '',
+    ]
+    return '\n'.join(lines)
+
+
+def main(argv):
+    if len(argv) != 4:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 1
+    input_path, source_path, header_path = argv[1:]
+
+    with open(input_path, encoding='utf-8') as input_file:
+        table = json.load(input_file)
+
+    tasks = []
+    names = set()
+    for i, task in enumerate(table.get('tasks', [])):
+        try:
+            tasks.append(validate(task, names))
+        except TaskError as error:
+            print(f'{input_path}: task {i}: {error}', file=sys.stderr)
+            return 1
+        names.add(tasks[-1]['name'])
+    if not tasks:
+        print(f'{input_path}: no tasks', file=sys.stderr)
+        return 1
+
+    header = os.path.basename(header_path)
+    with open(source_path, 'w', encoding='utf-8') as source:
+        source.write(generate_source(tasks, header))
+    with open(header_path, 'w', encoding='utf-8') as output:
+        output.write(generate_header(tasks, header))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))